@@ -0,0 +1,182 @@
+//#define DEBUG_ACTION_PIPELINE
+#include "action_pipeline.hpp"
+
+#include <cassert>
+#include <utility>
+
+#include <QApplication>
+#include <QWidget>
+#include <QtCore/QThread>
+
+#include "agent.hpp"
+#include "func_event.hpp"
+#include "widget_index.hpp"
+
+using qt_monkey_agent::Private::ActionPipeline;
+using qt_monkey_agent::Private::FuncEvent;
+using qt_monkey_agent::Private::NestedLoopWatcher;
+
+#ifdef DEBUG_ACTION_PIPELINE
+#define DBGPRINT(fmt, ...) qDebug(fmt, __VA_ARGS__)
+#else
+#define DBGPRINT(fmt, ...)                                                     \
+    do {                                                                       \
+    } while (false)
+#endif
+
+ActionPipeline::ActionPipeline(Agent &agent, int maxInFlight, QObject *parent)
+    : QObject(parent), agent_(agent), maxInFlight_(maxInFlight),
+      freeSlots_(maxInFlight),
+      funcEventType_(static_cast<QEvent::Type>(QEvent::registerEventType())),
+      stepEventType_(static_cast<QEvent::Type>(QEvent::registerEventType()))
+{
+    assert(maxInFlight_ > 0);
+}
+
+void ActionPipeline::post(Finder find, int waitWidgetSec, QString notFoundMsg,
+                          Action action)
+{
+    assert(QThread::currentThread() != thread());
+    freeSlots_.acquire();
+    auto item = std::make_shared<Item>(Item{std::move(find), waitWidgetSec,
+                                            std::move(notFoundMsg),
+                                            std::move(action)});
+    QCoreApplication::postEvent(this,
+                                new FuncEvent(funcEventType_, [this, item] {
+                                    queue_.push_back(std::move(*item));
+                                    scheduleStep();
+                                }));
+}
+
+QString ActionPipeline::sync()
+{
+    assert(QThread::currentThread() != thread());
+    freeSlots_.acquire(maxInFlight_);
+    freeSlots_.release(maxInFlight_);
+    auto err = firstError_.get();
+    QString res;
+    res.swap(*err);
+    return res;
+}
+
+bool ActionPipeline::event(QEvent *event)
+{
+    if (event->type() == funcEventType_) {
+        static_cast<FuncEvent *>(event)->exec();
+        return true;
+    } else if (event->type() == stepEventType_) {
+        stepPosted_ = false;
+        step();
+        return true;
+    }
+    return QObject::event(event);
+}
+
+void ActionPipeline::scheduleStep()
+{
+    if (stepPosted_)
+        return;
+    stepPosted_ = true;
+    // low priority, so events caused by previous action handled before
+    QCoreApplication::postEvent(this, new QEvent(stepEventType_),
+                                Qt::LowEventPriority);
+}
+
+void ActionPipeline::step()
+{
+    if (waitingWidget_ || queue_.empty())
+        return;
+    // previous action not completed yet, continue only if it waits
+    // in nested event loop, for example in modal dialog
+    if (!running_.empty() && !running_.back()->loopState.inNestedLoop())
+        return;
+    if (hasError()) {
+        dropQueue();
+        return;
+    }
+    Item &item = queue_.front();
+    QWidget *w = item.find(true);
+    if (w == nullptr) {
+        if (!searchTimer_.isValid())
+            searchTimer_.start();
+        if (searchTimer_.elapsed() >= item.waitWidgetSec * 1000ll) {
+            DBGPRINT("%s: widget not found", Q_FUNC_INFO);
+            searchTimer_.invalidate();
+            setError(std::move(item.notFoundMsg));
+            dropQueue();
+            return;
+        }
+        waitingWidget_ = true;
+        agent_.widgetIndex().addWaiter([this] {
+            assert(!queue_.empty());
+            const Item &item = queue_.front();
+            if (item.find(false) == nullptr
+                && searchTimer_.elapsed() < item.waitWidgetSec * 1000ll)
+                return false;
+            waitingWidget_ = false;
+            scheduleStep();
+            return true;
+        });
+        return;
+    }
+    searchTimer_.invalidate();
+    Item cur = std::move(item);
+    queue_.pop_front();
+    perform(std::move(cur), *w);
+}
+
+void ActionPipeline::perform(Item item, QWidget &w)
+{
+    auto running = std::make_shared<Running>();
+    running->loopState.remember();
+    running_.push_back(running);
+    QString errMsg;
+    {
+        // if action runs nested event loop, for example shows modal dialog,
+        // next action should be started inside of it
+        NestedLoopWatcher watcher{[this, running] {
+            DBGPRINT("%s: action started nested event loop", Q_FUNC_INFO);
+            settle(*running);
+            scheduleStep();
+        }};
+        errMsg = item.action(w);
+    }
+    assert(running_.back() == running);
+    running_.pop_back();
+    if (!errMsg.isEmpty())
+        setError(std::move(errMsg));
+    settle(*running);
+    scheduleStep();
+}
+
+void ActionPipeline::settle(Running &running)
+{
+    if (running.settled)
+        return;
+    running.settled = true;
+    freeSlots_.release();
+}
+
+void ActionPipeline::setError(QString errMsg)
+{
+    DBGPRINT("%s: %s", Q_FUNC_INFO, qPrintable(errMsg));
+    auto err = firstError_.get();
+    if (err->isEmpty())
+        *err = std::move(errMsg);
+}
+
+bool ActionPipeline::hasError()
+{
+    auto err = firstError_.get();
+    return !err->isEmpty();
+}
+
+void ActionPipeline::dropQueue()
+{
+    DBGPRINT("%s: drop %u actions", Q_FUNC_INFO,
+             static_cast<unsigned>(queue_.size()));
+    const int n = static_cast<int>(queue_.size());
+    queue_.clear();
+    if (n > 0)
+        freeSlots_.release(n);
+}
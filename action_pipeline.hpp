@@ -0,0 +1,104 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QEvent>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+
+#include "event_loop_state.hpp"
+#include "semaphore.hpp"
+#include "shared_resource.hpp"
+
+class QWidget;
+
+namespace qt_monkey_agent
+{
+class Agent;
+namespace Private
+{
+/**
+ * Queue of script actions for pipelined mode of script execution.
+ * Script thread only posts actions and continue to run script,
+ * GUI thread executes actions one by one, search of widget for next action
+ * starts just after previous one completed without round trip to script
+ * thread. Errors are reported by sync, so script should call it
+ * before reading state of GUI.
+ * Should be created in GUI thread.
+ */
+class ActionPipeline final : public QObject
+{
+public:
+    /**
+     * search widget, called in GUI thread
+     * @param mayRescan see WidgetIndex::topmostWithName
+     */
+    using Finder = std::function<QWidget *(bool mayRescan)>;
+    //! called in GUI thread, @return error message or empty string
+    using Action = std::function<QString(QWidget &)>;
+
+    ActionPipeline(Agent &agent, int maxInFlight, QObject *parent = nullptr);
+    ActionPipeline(const ActionPipeline &) = delete;
+    ActionPipeline &operator=(const ActionPipeline &) = delete;
+
+    //@{
+    //! should be called not from GUI thread
+    /**
+     * Post action, block if there are too many not completed actions
+     * @param find how to find widget for action
+     * @param waitWidgetSec how long wait widget appearing
+     * @param notFoundMsg error if widget not found
+     */
+    void post(Finder find, int waitWidgetSec, QString notFoundMsg,
+              Action action);
+    /**
+     * Wait until all posted actions completed or started nested event loop
+     * @return first error since last sync, actions after error are dropped
+     */
+    QString sync();
+    //@}
+private:
+    struct Item final {
+        Finder find;
+        int waitWidgetSec;
+        QString notFoundMsg;
+        Action action;
+    };
+    //! action that executed right now, may be in nested event loop
+    struct Running final {
+        EventLoopState loopState;
+        bool settled = false;
+    };
+
+    Agent &agent_;
+    const int maxInFlight_;
+    //! one unit per posted, but not settled action
+    qt_monkey_common::Semaphore freeSlots_;
+    qt_monkey_common::SharedResource<QString> firstError_;
+    QEvent::Type funcEventType_;
+    QEvent::Type stepEventType_;
+    //@{
+    //! accessed only from GUI thread
+    std::deque<Item> queue_;
+    std::vector<std::shared_ptr<Running>> running_;
+    bool stepPosted_ = false;
+    bool waitingWidget_ = false;
+    QElapsedTimer searchTimer_;
+    //@}
+
+    bool event(QEvent *event) override;
+    void scheduleStep();
+    void step();
+    void perform(Item item, QWidget &w);
+    void settle(Running &running);
+    void setError(QString errMsg);
+    bool hasError();
+    //! drop not started actions after error
+    void dropQueue();
+};
+} // namespace Private
+} // namespace qt_monkey_agent
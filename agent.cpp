@@ -6,6 +6,7 @@
 #include <chrono>
 #include <cstdlib>
 #include <functional>
+#include <memory>
 #include <thread>
 
 #include <QApplication>
@@ -14,21 +15,30 @@
 #include <QtCore/QDir>
 #include <QtCore/QThread>
 
+#include "action_pipeline.hpp"
 #include "agent_qtmonkey_communication.hpp"
 #include "common.hpp"
+#include "event_loop_state.hpp"
 #include "script.hpp"
 #include "script_api.hpp"
 #include "script_runner.hpp"
 #include "user_events_analyzer.hpp"
+#include "widget_index.hpp"
 
 using qt_monkey_agent::Agent;
 using qt_monkey_agent::CustomEventAnalyzer;
 using qt_monkey_agent::PopulateScriptContext;
 using qt_monkey_agent::UserEventsAnalyzer;
+using qt_monkey_agent::Private::ActionPipeline;
 using qt_monkey_agent::Private::CommunicationAgentPart;
+using qt_monkey_agent::Private::FuncEvent;
+using qt_monkey_agent::Private::NestedLoopWatcher;
 using qt_monkey_agent::Private::PacketTypeForMonkey;
+using qt_monkey_agent::Private::RecordedEvent;
+using qt_monkey_agent::Private::recordedEventToScript;
 using qt_monkey_agent::Private::Script;
 using qt_monkey_agent::Private::ScriptRunner;
+using qt_monkey_agent::Private::WidgetIndex;
 using qt_monkey_common::Semaphore;
 
 Agent *Agent::gAgent_ = nullptr;
@@ -49,18 +59,8 @@ Agent *Agent::gAgent_ = nullptr;
 
 namespace
 {
-class FuncEvent final : public QEvent
-{
-public:
-    FuncEvent(QEvent::Type type, std::function<void()> func)
-        : QEvent(type), func_(std::move(func))
-    {
-    }
-    void exec() { func_(); }
-
-private:
-    std::function<void()> func_;
-};
+// how many actions script can post without waiting their completion
+static const int maxActionsInPipeline = 32;
 
 class EventsReciever final : public QObject
 {
@@ -102,9 +102,11 @@ public:
                 Qt::DirectConnection);
         connect(
             &client,
-            SIGNAL(runScript(const qt_monkey_agent::Private::Script &)),
+            SIGNAL(
+                runScript(const qt_monkey_agent::Private::Script &, bool)),
             parent(),
-            SLOT(onRunScriptCommand(const qt_monkey_agent::Private::Script &)),
+            SLOT(onRunScriptCommand(const qt_monkey_agent::Private::Script &,
+                                    bool)),
             Qt::DirectConnection);
         EventsReciever eventReciever;
         objInThread_ = &eventReciever;
@@ -115,12 +117,12 @@ public:
 
     CommunicationAgentPart *channelWithMonkey() { return channelWithMonkey_; }
 
-    void runInThread(std::function<void()> func)
+    template <typename Func> void runInThread(Func &&func)
     {
         assert(objInThread_ != nullptr);
         QCoreApplication::postEvent(
-            objInThread_,
-            new FuncEvent(objInThread_->eventType(), std::move(func)));
+            objInThread_, new FuncEvent(objInThread_->eventType(),
+                                        std::forward<Func>(func)));
     }
 
 private:
@@ -171,6 +173,8 @@ Agent::Agent(const QKeySequence &showObjectShortcut,
              PopulateScriptContext psc)
     : eventAnalyzer_(new UserEventsAnalyzer(
           *this, showObjectShortcut, std::move(customEventAnalyzers), this)),
+      widgetIndex_(new WidgetIndex(this)),
+      actionPipeline_(new ActionPipeline(*this, maxActionsInPipeline, this)),
       populateScriptContextCallback_(std::move(psc)),
       screenshots_(std::make_pair(QString(), -1))
 {
@@ -180,11 +184,10 @@ Agent::Agent(const QKeySequence &showObjectShortcut,
     qMetaTypeId<qt_monkey_agent::Private::Script>();
     eventType_ = static_cast<QEvent::Type>(QEvent::registerEventType());
     connect(qApp, SIGNAL(aboutToQuit()), this, SLOT(onAppAboutToQuit()));
-    connect(eventAnalyzer_, SIGNAL(userEventInScriptForm(const QString &)),
-            this, SLOT(onUserEventInScriptForm(const QString &)));
-    connect(eventAnalyzer_, SIGNAL(scriptLog(const QString &)), this,
-            SLOT(onScriptLog(const QString &)));
+    connect(eventAnalyzer_, SIGNAL(newRecordedEvents()), this,
+            SLOT(onNewRecordedEvents()));
     QCoreApplication::instance()->installEventFilter(eventAnalyzer_);
+    QCoreApplication::instance()->installEventFilter(widgetIndex_);
     thread_ = new AgentThread(this);
     thread_->start();
     while (!thread_->isFinished()
@@ -202,23 +205,39 @@ Agent::~Agent()
 {
     GET_THREAD(thread)
 
-    thread->runInThread(
-        [thread] { thread->channelWithMonkey()->flushSendData(); });
+    thread->runInThread([this, thread] {
+        sendRecordedEvents();
+        thread->channelWithMonkey()->flushSendData();
+    });
     QCoreApplication::processEvents(QEventLoop::AllEvents, 1000 /*ms*/);
     thread->quit();
     thread->wait();
 }
 
-void Agent::onUserEventInScriptForm(const QString &script)
+void Agent::onNewRecordedEvents()
 {
-    if (script.isEmpty())
-        return;
     GET_THREAD(thread)
-    thread->channelWithMonkey()->sendCommand(
-        PacketTypeForMonkey::NewUserAppEvent, script);
+    thread->runInThread([this] { sendRecordedEvents(); });
 }
 
-void Agent::onRunScriptCommand(const Script &script)
+void Agent::sendRecordedEvents()
+{
+    GET_THREAD(thread)
+    assert(QThread::currentThread() == thread_);
+    CommunicationAgentPart *channel = thread->channelWithMonkey();
+    eventAnalyzer_->consumeRecordedEvents([channel](RecordedEvent event) {
+        if (event.type == RecordedEvent::Type::Log) {
+            channel->sendCommand(PacketTypeForMonkey::ScriptLog, event.text);
+            return;
+        }
+        const QString script = recordedEventToScript(event);
+        if (!script.isEmpty())
+            channel->sendCommand(PacketTypeForMonkey::NewUserAppEvent,
+                                 script);
+    });
+}
+
+void Agent::onRunScriptCommand(const Script &script, bool moreScriptsQueued)
 {
     GET_THREAD(thread)
     assert(QThread::currentThread() == thread_);
@@ -234,10 +253,17 @@ void Agent::onRunScriptCommand(const Script &script)
         scriptBaseName_ = fi.baseName();
         sr.runScript(script, errMsg);
     }
+    // in pipeline mode last actions of script may be not completed yet
+    const QString pipelineErrMsg = actionPipeline_->sync();
+    if (errMsg.isEmpty())
+        errMsg = pipelineErrMsg;
     if (!errMsg.isEmpty()) {
         qWarning("AGENT: %s: script return error", Q_FUNC_INFO);
+        sendRecordedEvents();
         thread->channelWithMonkey()->sendCommand(
             PacketTypeForMonkey::ScriptError, errMsg);
+    } else if (moreScriptsQueued) {
+        DBGPRINT("%s: next script already queued, no wait", Q_FUNC_INFO);
     } else {
         DBGPRINT("%s: sync with gui", Q_FUNC_INFO);
         // if all ok, sync with gui, so user recieve all events
@@ -253,6 +279,7 @@ void Agent::onRunScriptCommand(const Script &script)
             10 * 1000);
     }
     DBGPRINT("%s: report about script end", Q_FUNC_INFO);
+    sendRecordedEvents();
     thread->channelWithMonkey()->sendCommand(PacketTypeForMonkey::ScriptEnd,
                                              QString());
 }
@@ -297,16 +324,55 @@ void Agent::scriptCheckPoint()
 }
 
 QString Agent::runCodeInGuiThreadSync(std::function<QString()> func)
+{
+    return callInGuiThreadSync(func);
+}
+
+static bool isGuiIdle()
+{
+#if QT_VERSION >= 0x050500
+    if (QThread::currentThread()->loopLevel() > 1)
+        return false;
+#else
+    if (qApp->activeModalWidget() != nullptr
+        || qApp->activePopupWidget() != nullptr)
+        return false;
+#endif
+    QAbstractEventDispatcher *dispatcher = QAbstractEventDispatcher::instance();
+    return dispatcher == nullptr || !dispatcher->hasPendingEvents();
+}
+
+bool Agent::waitForGuiIdle(std::chrono::milliseconds maxWait)
 {
     assert(QThread::currentThread() == thread_);
-    QString res;
-    QCoreApplication::postEvent(this,
-                                new FuncEvent(eventType_, [func, this, &res] {
-                                    res = func();
-                                    guiRunSem_.release();
-                                }));
-    guiRunSem_.acquire();
-    return res;
+    using std::chrono::steady_clock;
+    // timer may fire and post new events just after check,
+    // so require several idle probes in a row
+    const int needIdleProbes = 2;
+    const steady_clock::time_point deadline = steady_clock::now() + maxWait;
+    int idleProbes = 0;
+    while (idleProbes < needIdleProbes) {
+        struct Probe final {
+            Semaphore done{0};
+            bool idle = false;
+        };
+        // probe can outlive this function in case of timeout
+        auto probe = std::make_shared<Probe>();
+        // low priority, so probe is handled after all already posted events
+        auto probeEvent = new FuncEvent(eventType_, [probe] {
+            probe->idle = isGuiIdle();
+            probe->done.release();
+        });
+        QCoreApplication::postEvent(this, probeEvent, Qt::LowEventPriority);
+        const auto timeLeft = deadline - steady_clock::now();
+        if (timeLeft <= steady_clock::duration::zero()
+            || !probe->done.tryAcquire(1, timeLeft)) {
+            DBGPRINT("%s: timeout", Q_FUNC_INFO);
+            return false;
+        }
+        idleProbes = probe->idle ? idleProbes + 1 : 0;
+    }
+    return true;
 }
 
 void Agent::customEvent(QEvent *event)
@@ -324,70 +390,47 @@ void Agent::throwScriptError(QString msg)
     curScriptRunner_->throwError(std::move(msg));
 }
 
+namespace
+{
+//! state of function call from runCodeInGuiThreadSyncWithTimeout
+struct SyncCallState final {
+    Semaphore wakeup{0};
+    //! accessed only from GUI thread before wakeup
+    bool finished = false;
+    bool nestedLoop = false;
+    QString result;
+};
+} // namespace
+
 QString Agent::runCodeInGuiThreadSyncWithTimeout(std::function<QString()> func,
                                                  int timeoutSecs)
 {
     assert(QThread::currentThread() == thread_);
-    QWidget *wasDialog = nullptr;
-    runCodeInGuiThreadSync([&wasDialog] {
-        wasDialog = qApp->activeModalWidget();
+    // state can outlive this function in case of timeout or nested loop
+    auto state = std::make_shared<SyncCallState>();
+    QCoreApplication::postEvent(
+        this, new FuncEvent(eventType_, [func, state] {
+            // if func runs nested event loop (modal dialog, menu),
+            // do not wait until it ends
+            NestedLoopWatcher watcher{[state] {
+                DBGPRINT("%s: nested event loop detected", Q_FUNC_INFO);
+                state->finished = true;
+                state->nestedLoop = true;
+                state->wakeup.release();
+            }};
+            QString res = func();
+            if (state->finished)
+                return;
+            state->finished = true;
+            state->result = std::move(res);
+            state->wakeup.release();
+        }));
+
+    if (!state->wakeup.tryAcquire(1, std::chrono::seconds(timeoutSecs))) {
+        DBGPRINT("%s: timeout occuire", Q_FUNC_INFO);
         return QString();
-    });
-
-    std::shared_ptr<Semaphore> waitSem{new Semaphore{0}};
-    std::shared_ptr<QString> res{new QString};
-    qApp->postEvent(this, new FuncEvent(eventType_, [func, waitSem, res] {
-                        *res = func();
-                        waitSem->release();
-                    }));
-
-    // make sure that prev event was handled
-    std::shared_ptr<Semaphore> syncSem{new Semaphore{0}};
-    qApp->postEvent(this, new FuncEvent(eventType_, [this, syncSem] {
-                        syncSem->release();
-                        qApp->sendPostedEvents(this, eventType_);
-                        syncSem->release();
-                    }));
-    syncSem->acquire();
-    const int timeoutMsec = timeoutSecs * 1000;
-    const int waitIntervalMsec = 100;
-    const int N = timeoutMsec / waitIntervalMsec + 1;
-    int attempt;
-    for (attempt = 0; attempt < N / 2; ++attempt) {
-        if (syncSem->tryAcquire(1, std::chrono::milliseconds(waitIntervalMsec)))
-            break;
-        qApp->processEvents(QEventLoop::ExcludeUserInputEvents);
-    }
-
-    QWidget *nowDialog = nullptr;
-    runCodeInGuiThreadSync([&nowDialog] {
-        nowDialog = qApp->activeModalWidget();
-        return QString();
-    });
-
-    for (unsigned int iter = 0; nowDialog == wasDialog; ++iter) {
-        if (waitSem->tryAcquire(1,
-                                std::chrono::milliseconds(waitIntervalMsec))) {
-            return *res;
-        }
-        if ((iter % 10) == 0) {
-            nowDialog = nullptr;
-            runCodeInGuiThreadSync([&nowDialog] {
-                nowDialog = qApp->activeModalWidget();
-                return QString();
-            });
-            DBGPRINT("%s: wasDialog %p, nowDialog %p, attempt %d", Q_FUNC_INFO,
-                     wasDialog, nowDialog, attempt);
-        }
     }
-
-    for (; attempt < N; ++attempt) {
-        if (waitSem->tryAcquire(1, std::chrono::milliseconds(waitIntervalMsec)))
-            return *res;
-        qApp->processEvents(QEventLoop::ExcludeUserInputEvents);
-    }
-    DBGPRINT("%s: timeout occuire", Q_FUNC_INFO);
-    return QString();
+    return state->nestedLoop ? QString() : state->result;
 }
 
 void Agent::onAppAboutToQuit()
@@ -395,21 +438,17 @@ void Agent::onAppAboutToQuit()
     qDebug("%s: begin", Q_FUNC_INFO);
     assert(QThread::currentThread() != thread_);
     GET_THREAD(thread)
-    thread->channelWithMonkey()->sendCommand(PacketTypeForMonkey::Close,
-                                             QString());
+    // events recorded before close should be sent before it
+    thread->runInThread([this, thread] {
+        sendRecordedEvents();
+        thread->channelWithMonkey()->sendCommand(PacketTypeForMonkey::Close,
+                                                 QString());
+    });
     while (!thread->channelWithMonkey()->hasCloseAck()) {
         qt_monkey_common::processEventsFor(300 /*ms*/);
     }
 }
 
-void Agent::onScriptLog(const QString &msg)
-{
-    assert(QThread::currentThread() != thread_);
-    GET_THREAD(thread)
-    thread->channelWithMonkey()->sendCommand(PacketTypeForMonkey::ScriptLog,
-                                             msg);
-}
-
 void Agent::saveScreenshots(const QString &path, int nSteps)
 {
     DBGPRINT("%s: path '%s', nsteps %d", Q_FUNC_INFO, qPrintable(path), nSteps);
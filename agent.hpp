@@ -2,14 +2,18 @@
 
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <map>
 
 #include <QKeySequence>
+#include <QtCore/QCoreApplication>
 #include <QtCore/QEvent>
 #include <QtCore/QObject>
+#include <QtCore/QThread>
 
 #include "custom_event_analyzer.hpp"
 #include "custom_script_extension.hpp"
+#include "func_event.hpp"
 #include "semaphore.hpp"
 #include "shared_resource.hpp"
 
@@ -26,6 +30,8 @@ namespace Private
 class Script;
 class ScriptRunner;
 class MacMenuActionWatcher;
+class WidgetIndex;
+class ActionPipeline;
 } // namespace Private
 /**
  * This class is used as agent inside user's program
@@ -68,22 +74,60 @@ public:
      * @return error message if error appear or empty string if all ok
      */
     QString runCodeInGuiThreadSync(std::function<QString()> func);
+    /**
+     * The same as runCodeInGuiThreadSync, but also returns as soon as
+     * @a func starts nested event loop (modal dialog, menu and so on),
+     * in this case or after @a timeoutSecs empty string is returned
+     */
     QString runCodeInGuiThreadSyncWithTimeout(std::function<QString()> func,
                                               int timeoutSecs);
     //@}
+    /**
+     * Run function in GUI thread, wait its completion and return its result,
+     * in steady state it do not allocate memory
+     * @param func function to run inside GUI thread, should return
+     * default constructible type
+     */
+    template <typename Func>
+    auto callInGuiThreadSync(Func &&func) -> decltype(func())
+    {
+        assert(QThread::currentThread() == thread_);
+        decltype(func()) res{};
+        QCoreApplication::postEvent(
+            this, new Private::FuncEvent(eventType_, [&func, &res, this] {
+                res = func();
+                guiRunSem_.release();
+            }));
+        guiRunSem_.acquire();
+        return res;
+    }
+    /**
+     * Wait until GUI thread become idle: there are no pending events
+     * and no nested event loop (like modal dialog or menu)
+     * @param maxWait maximum time to wait
+     * @return false if waiting was stopped by timeout
+     */
+    bool waitForGuiIdle(std::chrono::milliseconds maxWait);
     //! throw exception inside script
     void throwScriptError(QString msg);
     void setDemonstrationMode(bool val) { demonstrationMode_ = val; }
     bool demonstrationMode() const { return demonstrationMode_; }
+    //! in pipeline mode script do not wait completion of actions
+    void setPipelineMode(bool val) { pipelineMode_ = val; }
+    bool pipelineMode() const { return pipelineMode_; }
     void setTraceEnabled(bool val) { scriptTracingMode_ = val; }
     void saveScreenshots(const QString &path, int nSteps);
     static Agent *instance() { return gAgent_; }
+    //! index of application's widgets, should be used only in GUI thread
+    Private::WidgetIndex &widgetIndex() { return *widgetIndex_; }
+    //! queue of actions for pipeline mode, should be used from agent thread
+    Private::ActionPipeline &actionPipeline() { return *actionPipeline_; }
 private slots:
-    void onUserEventInScriptForm(const QString &);
+    void onNewRecordedEvents();
     void onCommunicationError(const QString &);
-    void onRunScriptCommand(const qt_monkey_agent::Private::Script &);
+    void onRunScriptCommand(const qt_monkey_agent::Private::Script &,
+                            bool moreScriptsQueued);
     void onAppAboutToQuit();
-    void onScriptLog(const QString &);
 
 private:
     friend class Private::MacMenuActionWatcher;
@@ -104,6 +148,8 @@ private:
     };
 
     qt_monkey_agent::UserEventsAnalyzer *eventAnalyzer_ = nullptr;
+    Private::WidgetIndex *widgetIndex_ = nullptr;
+    Private::ActionPipeline *actionPipeline_ = nullptr;
     QThread *thread_ = nullptr;
     Private::ScriptRunner *curScriptRunner_ = nullptr;
     QEvent::Type eventType_;
@@ -112,9 +158,12 @@ private:
     static Agent *gAgent_;
     std::atomic<bool> demonstrationMode_{false};
     std::atomic<bool> scriptTracingMode_{false};
+    std::atomic<bool> pipelineMode_{false};
     qt_monkey_common::SharedResource<std::multimap<QString, QAction *>>
         menuItemsOnMac_;
     qt_monkey_common::SharedResource<std::pair<QString, int>> screenshots_;
+    //! convert recorded events to script and send them, only in agent thread
+    void sendRecordedEvents();
     QString scriptBaseName_;
 
     void customEvent(QEvent *event) override;
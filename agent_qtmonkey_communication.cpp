@@ -1,11 +1,17 @@
 //#define DEBUG_AGENT_QTMONKEY_COMMUNICATION
 #include "agent_qtmonkey_communication.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <type_traits>
 
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFileInfo>
+#include <QtCore/QIODevice>
 #include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QTextCodec>
 #include <QtCore/QThread>
 #include <QtCore/QTimerEvent>
 
@@ -15,6 +21,9 @@
 using namespace qt_monkey_agent::Private;
 
 static const char QTMONKEY_PORT_ENV_NAME[] = "QTMONKEY_PORT";
+static const char QTMONKEY_SOCKET_ENV_NAME[] = "QTMONKEY_SOCKET";
+static const char QTMONKEY_TRANSPORT_ENV_NAME[] = "QTMONKEY_TRANSPORT";
+static const char QTMONKEY_AGENT_NAME_ENV_NAME[] = "QTMONKEY_AGENT_NAME";
 
 #ifdef DEBUG_AGENT_QTMONKEY_COMMUNICATION
 #define DBGPRINT(fmt, ...) qDebug(fmt, __VA_ARGS__)
@@ -28,185 +37,495 @@ namespace
 {
 
 static const uint32_t magicNumber = 0x12345678u;
+//! magic number, type of packet and size of packet's data
+static const size_t headerSize = sizeof(magicNumber) + 2 * sizeof(uint32_t);
+//! limit for one packet, message may consist of several packets
+static const uint32_t maxPacketSize = 1024 * 1024;
+//! utf-8 of fragment is not bigger then 3 * maxFragmentChars
+static const int maxFragmentChars = 16 * 1024;
+//! how many bytes one side allows to wait for write in socket
+static const qint64 maxBufferedBytes = 256 * 1024;
+//! agent sends Hello just after connect, old agents do not send it at all
+static const int waitHelloMs = 1000;
+
+/**
+ * Append to buf packet with part of text that starts from pos
+ * @return position in text after encoded part
+ */
+static int appendPacketFragment(QByteArray &buf, uint32_t packetType,
+                                const QString &text, int pos)
+{
+    assert((packetType & packetTypeContinuation) == 0);
+    int len = std::min(text.size() - pos, maxFragmentChars);
+    // do not split surrogate pair, so every fragment is valid utf-8
+    if (pos + len < text.size() && text.at(pos + len - 1).isHighSurrogate())
+        --len;
+    if (pos + len < text.size())
+        packetType |= packetTypeContinuation;
+    const int start = buf.size();
+    buf.resize(start + static_cast<int>(headerSize));
+    buf.append(text.midRef(pos, len).toUtf8());
+    const uint32_t packetSize
+        = static_cast<uint32_t>(buf.size() - start - headerSize);
+    char *header = buf.data() + start;
+    std::memcpy(header, &magicNumber, sizeof(magicNumber));
+    std::memcpy(header + sizeof(magicNumber), &packetType,
+                sizeof(packetType));
+    std::memcpy(header + sizeof(magicNumber) + sizeof(packetType),
+                &packetSize, sizeof(packetSize));
+    return pos + len;
+}
+
+static const uint32_t agentCapabilities
+    = static_cast<uint32_t>(Capability::ScriptQueue);
+static const uint32_t monkeyCapabilities
+    = static_cast<uint32_t>(Capability::ScriptQueue);
 
-enum class PacketState { Damaged, NotReady, Ready };
+/**
+ * text of Hello packet: protocol version, capabilities and
+ * optional name of process (may contain spaces, so it is the last)
+ */
+static QString helloText(uint32_t capabilities, const QString &processName)
+{
+    QString res
+        = QStringLiteral("%1 %2").arg(protocolVersion).arg(capabilities);
+    if (!processName.isEmpty())
+        res += QLatin1Char(' ') + processName;
+    return res;
+}
+
+static bool parseHello(const QString &text, uint32_t &capabilities,
+                       QString &processName)
+{
+    const QStringList parts = text.split(QLatin1Char(' '));
+    if (parts.size() < 2)
+        return false;
+    processName = text.section(QLatin1Char(' '), 2);
+    bool ok = false;
+    const uint32_t version = parts[0].toUInt(&ok);
+    if (!ok)
+        return false;
+    capabilities = parts[1].toUInt(&ok);
+    if (!ok)
+        return false;
+    if (version != protocolVersion)
+        qWarning("%s: other side use protocol version %u, we %u", Q_FUNC_INFO,
+                 static_cast<unsigned>(version),
+                 static_cast<unsigned>(protocolVersion));
+    return true;
+}
+
+//! name of process to address it from script
+static QString agentProcessName()
+{
+    const QByteArray name = qgetenv(QTMONKEY_AGENT_NAME_ENV_NAME);
+    if (!name.isEmpty())
+        return QString::fromLocal8Bit(name);
+    if (!QCoreApplication::applicationName().isEmpty())
+        return QCoreApplication::applicationName();
+    return QFileInfo(QCoreApplication::applicationFilePath()).baseName();
+}
+
+static Transport transportFromEnvironment()
+{
+    const QByteArray name = qgetenv(QTMONKEY_TRANSPORT_ENV_NAME);
+    if (name.isEmpty() || name == "tcp")
+        return Transport::Tcp;
+    if (name == "local")
+        return Transport::Local;
+    qWarning("%s: unknown %s value '%s', use tcp", Q_FUNC_INFO,
+             QTMONKEY_TRANSPORT_ENV_NAME, name.constData());
+    return Transport::Tcp;
+}
 
-static PacketState calcPacketState(const QByteArray &buf)
+static bool isSocketConnected(const QIODevice *sock)
 {
-    if (static_cast<size_t>(buf.size()) < sizeof(magicNumber))
-        return PacketState::NotReady;
+    if (sock == nullptr)
+        return false;
+    if (auto tcp = qobject_cast<const QAbstractSocket *>(sock))
+        return tcp->state() == QAbstractSocket::ConnectedState;
+    auto local = qobject_cast<const QLocalSocket *>(sock);
+    return local != nullptr && local->state() == QLocalSocket::ConnectedState;
+}
+
+static void flushSocket(QIODevice &sock)
+{
+    if (auto tcp = qobject_cast<QAbstractSocket *>(&sock))
+        tcp->flush();
+    else if (auto local = qobject_cast<QLocalSocket *>(&sock))
+        local->flush();
+}
+} // namespace
+
+PacketReader::PacketReader() {}
+
+PacketReader::~PacketReader() {}
+
+qint64 PacketReader::readFrom(QIODevice &dev, qint64 nBytes)
+{
+    assert(nBytes > 0);
+    compact();
+    const int wasSize = buf_.size();
+    buf_.resize(wasSize + static_cast<int>(nBytes));
+    const qint64 readBytes = dev.read(buf_.data() + wasSize, nBytes);
+    buf_.resize(wasSize + static_cast<int>(std::max<qint64>(readBytes, 0)));
+    return readBytes;
+}
+
+void PacketReader::append(const char *data, int len)
+{
+    compact();
+    buf_.append(data, len);
+}
+
+void PacketReader::compact()
+{
+    if (readPos_ == 0)
+        return;
+    if (isEmpty()) {
+        buf_.resize(0);
+        readPos_ = 0;
+    } else if (readPos_ >= buf_.size() - readPos_) {
+        // copy less data than was consumed since last compaction
+        buf_.remove(0, readPos_);
+        readPos_ = 0;
+    }
+}
+
+PacketReader::State PacketReader::packetState() const
+{
+    const size_t avail = static_cast<size_t>(buf_.size() - readPos_);
+    if (avail < sizeof(magicNumber))
+        return State::NotReady;
+    const char *p = buf_.constData() + readPos_;
     std::remove_const<decltype(magicNumber)>::type curMagicNumber;
-    std::memcpy(&curMagicNumber, buf.constData(), sizeof(curMagicNumber));
+    std::memcpy(&curMagicNumber, p, sizeof(curMagicNumber));
     if (curMagicNumber != magicNumber)
-        return PacketState::Damaged;
-    uint32_t packetType;
+        return State::Damaged;
+    if (avail < headerSize)
+        return State::NotReady;
     uint32_t packetSize;
-    const size_t headerSize
-        = sizeof(magicNumber) + sizeof(packetType) + sizeof(packetSize);
-    if (static_cast<size_t>(buf.size()) < headerSize)
-        return PacketState::NotReady;
-    std::memcpy(&packetSize,
-                buf.constData() + sizeof(magicNumber) + sizeof(packetType),
+    std::memcpy(&packetSize, p + sizeof(magicNumber) + sizeof(uint32_t),
                 sizeof(packetSize));
-    if (packetSize > (1024 * 1024))
-        return PacketState::Damaged;
-    if (static_cast<size_t>(buf.size()) < (packetSize + headerSize))
-        return PacketState::NotReady;
-    return PacketState::Ready;
+    if (packetSize > maxPacketSize)
+        return State::Damaged;
+    if (avail < (packetSize + headerSize))
+        return State::NotReady;
+    return State::Ready;
 }
 
-static QByteArray createPacket(uint32_t packetType, const QString &text)
+PacketReader::State PacketReader::state()
 {
-    QByteArray res;
-    uint32_t packetSize;
-    const size_t headerSize
-        = sizeof(magicNumber) + sizeof(packetType) + sizeof(packetSize);
-    res.reserve(headerSize + text.length());
-    res.resize(headerSize);
-    res.append(text.toUtf8());
-    packetSize = res.size() - headerSize;
-    std::memcpy(res.data(), &magicNumber, sizeof(magicNumber));
-    std::memcpy(res.data() + sizeof(magicNumber), &packetType,
-                sizeof(packetType));
-    std::memcpy(res.data() + sizeof(magicNumber) + sizeof(packetType),
-                &packetSize, sizeof(packetSize));
-    return res;
+    for (;;) {
+        const State res = packetState();
+        if (res != State::Ready)
+            return res;
+        const char *p = buf_.constData() + readPos_;
+        uint32_t packetType;
+        std::memcpy(&packetType, p + sizeof(magicNumber), sizeof(packetType));
+        const uint32_t messageType = packetType & ~packetTypeContinuation;
+        if (decoder_ != nullptr && messageType != messageType_)
+            return State::Damaged;
+        if ((packetType & packetTypeContinuation) == 0)
+            return State::Ready;
+        uint32_t packetSize;
+        std::memcpy(&packetSize, p + sizeof(magicNumber) + sizeof(packetType),
+                    sizeof(packetSize));
+        if (decoder_ == nullptr) {
+            // stateful decoder, so sender may split message
+            // in the middle of utf-8 sequence
+            decoder_.reset(QTextCodec::codecForName("UTF-8")->makeDecoder());
+            messageType_ = messageType;
+            message_.clear();
+        }
+        message_ += decoder_->toUnicode(p + headerSize,
+                                        static_cast<int>(packetSize));
+        readPos_ += static_cast<int>(headerSize + packetSize);
+    }
 }
 
-static std::pair<uint32_t, QString> extractFromPacket(QByteArray &buf)
+std::pair<uint32_t, QString> PacketReader::take()
 {
-    assert(calcPacketState(buf) == PacketState::Ready);
+    assert(packetState() == State::Ready);
+    const char *p = buf_.constData() + readPos_;
     uint32_t packetType;
-    std::memcpy(&packetType, buf.constData() + sizeof(magicNumber),
-                sizeof(packetType));
+    std::memcpy(&packetType, p + sizeof(magicNumber), sizeof(packetType));
+    assert((packetType & packetTypeContinuation) == 0);
     uint32_t packetSize;
-    std::memcpy(&packetSize,
-                buf.constData() + sizeof(magicNumber) + sizeof(packetType),
+    std::memcpy(&packetSize, p + sizeof(magicNumber) + sizeof(packetType),
                 sizeof(packetSize));
-    const size_t headerSize
-        = sizeof(magicNumber) + sizeof(packetType) + sizeof(packetSize);
-    assert((packetSize + headerSize) <= static_cast<size_t>(buf.size()));
-    std::pair<uint32_t, QString> res{
-        packetType,
-        QString::fromUtf8(buf.constData() + headerSize, packetSize)};
-    buf.remove(0, headerSize + packetSize);
+    std::pair<uint32_t, QString> res;
+    res.first = packetType;
+    if (decoder_ == nullptr) {
+        res.second
+            = QString::fromUtf8(p + headerSize, static_cast<int>(packetSize));
+    } else {
+        assert(messageType_ == packetType);
+        message_ += decoder_->toUnicode(p + headerSize,
+                                        static_cast<int>(packetSize));
+        res.second.swap(message_);
+        decoder_.reset();
+    }
+    readPos_ += static_cast<int>(headerSize + packetSize);
     return res;
 }
-} // namespace
+
+void PacketReader::clear()
+{
+    buf_.clear();
+    readPos_ = 0;
+    decoder_.reset();
+    message_.clear();
+}
 
 CommunicationMonkeyPart::CommunicationMonkeyPart(QObject *parent)
-    : QObject(parent), controlSock_{new QTcpServer}
+    : QObject(parent), transport_(transportFromEnvironment())
 {
-    connect(controlSock_.get(), SIGNAL(newConnection()), this,
-            SLOT(handleNewConnection()));
-    if (!controlSock_->listen(QHostAddress::LocalHost))
-        throw std::runtime_error(
-            qPrintable(T_("start listen of tcp socket failed")));
-    envPrefs_ = {QLatin1String(QTMONKEY_PORT_ENV_NAME),
-                 QString::number(controlSock_->serverPort())};
-    DBGPRINT("%s: we listen %d\n", Q_FUNC_INFO,
-             static_cast<int>(controlSock_->serverPort()));
+    switch (transport_) {
+    case Transport::Tcp:
+        controlSock_.reset(new QTcpServer);
+        connect(controlSock_.get(), SIGNAL(newConnection()), this,
+                SLOT(handleNewConnection()));
+        if (!controlSock_->listen(QHostAddress::LocalHost))
+            throw std::runtime_error(
+                qPrintable(T_("start listen of tcp socket failed")));
+        envPrefs_ = {QLatin1String(QTMONKEY_PORT_ENV_NAME),
+                     QString::number(controlSock_->serverPort())};
+        DBGPRINT("%s: we listen %d\n", Q_FUNC_INFO,
+                 static_cast<int>(controlSock_->serverPort()));
+        break;
+    case Transport::Local: {
+        // there are may be several monkeys on the same host,
+        // so name should be unique
+        static int serverNumber = 0;
+        const QString name = QStringLiteral("qtmonkey-%1-%2")
+                                 .arg(QCoreApplication::applicationPid())
+                                 .arg(serverNumber++);
+        localControlSock_.reset(new QLocalServer);
+        connect(localControlSock_.get(), SIGNAL(newConnection()), this,
+                SLOT(handleNewConnection()));
+        // remove stale socket file after crash of process with the same pid
+        QLocalServer::removeServer(name);
+        if (!localControlSock_->listen(name))
+            throw std::runtime_error(
+                qPrintable(T_("start listen of local socket failed: %1")
+                               .arg(localControlSock_->errorString())));
+        envPrefs_ = {QLatin1String(QTMONKEY_SOCKET_ENV_NAME),
+                     localControlSock_->fullServerName()};
+        DBGPRINT("%s: we listen %s\n", Q_FUNC_INFO,
+                 qPrintable(localControlSock_->fullServerName()));
+        break;
+    }
+    }
 }
 
+const int CommunicationMonkeyPart::invalidSession;
+
+CommunicationMonkeyPart::~CommunicationMonkeyPart() {}
+
 void CommunicationMonkeyPart::handleNewConnection()
 {
     DBGPRINT("%s: begin", Q_FUNC_INFO);
-    curClient_ = controlSock_->nextPendingConnection();
-    connect(curClient_, SIGNAL(readyRead()), this,
-            SLOT(readDataFromClientSocket()));
-    connect(curClient_, SIGNAL(bytesWritten(qint64)), this,
-            SLOT(flushSendData()));
-    connect(curClient_, SIGNAL(disconnected()), this,
-            SLOT(clientDisconnected()));
-    connect(curClient_, SIGNAL(error(QAbstractSocket::SocketError)), this,
-            SLOT(connectionError(QAbstractSocket::SocketError)));
+    QIODevice *sock;
+    if (transport_ == Transport::Tcp) {
+        sock = controlSock_->nextPendingConnection();
+        connect(sock, SIGNAL(error(QAbstractSocket::SocketError)), this,
+                SLOT(connectionError(QAbstractSocket::SocketError)));
+    } else {
+        sock = localControlSock_->nextPendingConnection();
+        connect(sock, SIGNAL(error(QLocalSocket::LocalSocketError)), this,
+                SLOT(localConnectionError(QLocalSocket::LocalSocketError)));
+    }
+    connect(sock, SIGNAL(readyRead()), this, SLOT(readDataFromClientSocket()));
+    connect(sock, SIGNAL(bytesWritten(qint64)), this, SLOT(flushSendData()));
+    connect(sock, SIGNAL(disconnected()), this, SLOT(clientDisconnected()));
+    std::unique_ptr<Session> session{new Session};
+    session->id = nextSessionId_++;
+    session->sock = sock;
+    // main process starts others, so it connects first
+    if (sessionById(mainSessionId_) == nullptr)
+        mainSessionId_ = session->id;
+    DBGPRINT("%s: new session %d", Q_FUNC_INFO, session->id);
+    // without Hello we do not know capabilities and name of agent,
+    // so scripts are not dispatched to it yet
+    session->waitHello.start(waitHelloMs, this);
+    sessions_.push_back(std::move(session));
+}
+
+void CommunicationMonkeyPart::setReady(Session &session)
+{
+    session.waitHello.stop();
+    session.ready = true;
     emit agentReadyToRunScript();
 }
 
+void CommunicationMonkeyPart::timerEvent(QTimerEvent *event)
+{
+    auto it = std::find_if(sessions_.begin(), sessions_.end(),
+                           [event](const std::unique_ptr<Session> &s) {
+                               return s->waitHello.timerId()
+                                      == event->timerId();
+                           });
+    if (it == sessions_.end()) {
+        QObject::timerEvent(event);
+        return;
+    }
+    qWarning("%s: no hello from agent of session %d in %d ms", Q_FUNC_INFO,
+             (*it)->id, waitHelloMs);
+    setReady(**it);
+}
+
+CommunicationMonkeyPart::Session *
+CommunicationMonkeyPart::sessionById(int sessionId) const
+{
+    auto it = std::find_if(sessions_.begin(), sessions_.end(),
+                           [sessionId](const std::unique_ptr<Session> &s) {
+                               return s->id == sessionId;
+                           });
+    return it != sessions_.end() ? it->get() : nullptr;
+}
+
+CommunicationMonkeyPart::Session *CommunicationMonkeyPart::senderSession() const
+{
+    QObject *sock = sender();
+    auto it = std::find_if(sessions_.begin(), sessions_.end(),
+                           [sock](const std::unique_ptr<Session> &s) {
+                               return s->sock == sock;
+                           });
+    return it != sessions_.end() ? it->get() : nullptr;
+}
+
 void CommunicationMonkeyPart::readDataFromClientSocket()
 {
-    assert(curClient_ != nullptr);
-    if (curClient_ == nullptr)
+    Session *session = senderSession();
+    assert(session != nullptr);
+    if (session == nullptr)
         return;
-    const qint64 nBytes = curClient_->bytesAvailable();
+    const qint64 nBytes = session->sock->bytesAvailable();
     if (nBytes <= 0) {
         qWarning("%s: no data availabile: %lld\n", Q_FUNC_INFO,
                  static_cast<long long>(nBytes));
         return;
     }
-    const auto wasSize = recvBuf_.size();
-    recvBuf_.resize(wasSize + nBytes);
-    const qint64 readBytes
-        = curClient_->read(recvBuf_.data() + wasSize, nBytes);
-    if (readBytes <= 0) {
+    PacketReader &recvBuf = session->recvBuf;
+    if (recvBuf.readFrom(*session->sock, nBytes) <= 0) {
         qWarning("%s: read data error", Q_FUNC_INFO);
-        recvBuf_.resize(wasSize);
         emit error(T_("Can not read data from client"));
         return;
     }
-    if (nBytes != readBytes)
-        recvBuf_.resize(wasSize + readBytes);
+    const int sessionId = session->id;
     for (;;) {
-        switch (calcPacketState(recvBuf_)) {
-        case PacketState::Damaged:
+        switch (recvBuf.state()) {
+        case PacketReader::State::Damaged:
             qWarning("%s: packet damaged", Q_FUNC_INFO);
-            recvBuf_.clear();
+            recvBuf.clear();
             emit error(T_("packet from qmonkey's agent damaged"));
             return;
-        case PacketState::NotReady:
+        case PacketReader::State::NotReady:
             /*nothing*/ return;
-        case PacketState::Ready: {
-            auto packet = extractFromPacket(recvBuf_);
-            switch (static_cast<PacketTypeForMonkey>(packet.first)) {
-            case PacketTypeForMonkey::NewUserAppEvent:
-                emit newUserAppEvent(std::move(packet.second));
-                break;
-            case PacketTypeForMonkey::ScriptError:
-                emit scriptError(std::move(packet.second));
-                break;
-            case PacketTypeForMonkey::ScriptEnd:
-                emit scriptEnd();
-                break;
-            case PacketTypeForMonkey::ScriptLog:
-                emit scriptLog(std::move(packet.second));
-                break;
-            case PacketTypeForMonkey::Close:
-                sendCommand(PacketTypeForAgent::CloseAck, QString());
-                break;
-            default:
-                qWarning("%s: unknown type of packet from qtmonkey's agent: %u",
-                         Q_FUNC_INFO, static_cast<unsigned>(packet.first));
-                emit error(T_("unknown type of packet from qtmonkey's agent"));
-                break;
-            }
+        case PacketReader::State::Ready: {
+            auto packet = recvBuf.take();
+            handlePacket(*session, packet.first, std::move(packet.second));
+            // handler of signal may close connection
+            if (sessionById(sessionId) != session)
+                return;
+        }
         }
+    }
+}
+
+void CommunicationMonkeyPart::handlePacket(Session &session, uint32_t type,
+                                           QString text)
+{
+    switch (static_cast<PacketTypeForMonkey>(type)) {
+    case PacketTypeForMonkey::NewUserAppEvent:
+        emit newUserAppEvent(session.id, std::move(text));
+        break;
+    case PacketTypeForMonkey::ScriptError:
+        emit scriptError(session.id, std::move(text));
+        break;
+    case PacketTypeForMonkey::ScriptEnd:
+        emit scriptEnd(session.id);
+        break;
+    case PacketTypeForMonkey::ScriptLog:
+        emit scriptLog(session.id, std::move(text));
+        break;
+    case PacketTypeForMonkey::Close:
+        sendCommand(session.id, PacketTypeForAgent::CloseAck, QString());
+        break;
+    case PacketTypeForMonkey::Hello:
+        if (!parseHello(text, session.capabilities, session.name)) {
+            emit error(T_("invalid hello from qtmonkey's agent: %1").arg(text));
+            break;
         }
+        DBGPRINT("%s: session %d, process '%s', agent capabilities %x",
+                 Q_FUNC_INFO, session.id, qPrintable(session.name),
+                 static_cast<unsigned>(session.capabilities));
+        sendCommand(session.id, PacketTypeForAgent::Hello,
+                    helloText(monkeyCapabilities, QString()));
+        // may be now we can send more scripts
+        setReady(session);
+        break;
+    default:
+        qWarning("%s: unknown type of packet from qtmonkey's agent: %u",
+                 Q_FUNC_INFO, static_cast<unsigned>(type));
+        emit error(T_("unknown type of packet from qtmonkey's agent"));
+        break;
     }
 }
 
 void CommunicationMonkeyPart::flushSendData()
 {
-    if (!sendBuf_.isEmpty()) {
-        assert(curClient_ != nullptr);
-        qint64 writen = curClient_->write(sendBuf_);
+    Session *session = senderSession();
+    if (session != nullptr)
+        flushSendData(*session);
+}
+
+void CommunicationMonkeyPart::flushSendData(Session &session)
+{
+    // the same as in agent: big script is encoded by fragments and only
+    // if socket has not too much data to write
+    while (!session.pending.empty()
+           && session.sendBuf.size() + session.sock->bytesToWrite()
+                  < maxBufferedBytes) {
+        PendingPacket &packet = session.pending.front();
+        session.textPos
+            = appendPacketFragment(session.sendBuf,
+                                   static_cast<uint32_t>(packet.type),
+                                   packet.text, session.textPos);
+        if (session.textPos == packet.text.size()) {
+            session.pending.pop_front();
+            session.textPos = 0;
+        }
+    }
+    if (!session.sendBuf.isEmpty()) {
+        qint64 writen = session.sock->write(session.sendBuf);
         if (writen == -1) {
             qWarning("%s: something wrong can not write to socket %s",
-                     Q_FUNC_INFO, qPrintable(curClient_->errorString()));
+                     Q_FUNC_INFO, qPrintable(session.sock->errorString()));
             return;
         } else {
             DBGPRINT("%s: wrote %lld bytes", Q_FUNC_INFO, writen);
         }
-        sendBuf_.remove(0, writen);
-        curClient_->flush();
+        session.sendBuf.remove(0, writen);
+        flushSocket(*session.sock);
     }
 }
 
 void CommunicationMonkeyPart::clientDisconnected()
 {
     DBGPRINT("%s: begin", Q_FUNC_INFO);
-    curClient_ = nullptr;
-    recvBuf_.clear();
-    sendBuf_.clear();
+    QObject *sock = sender();
+    auto it = std::find_if(sessions_.begin(), sessions_.end(),
+                           [sock](const std::unique_ptr<Session> &s) {
+                               return s->sock == sock;
+                           });
+    if (it == sessions_.end())
+        return;
+    const int sessionId = (*it)->id;
+    (*it)->sock->deleteLater();
+    sessions_.erase(it);
+    emit agentDisconnected(sessionId);
 }
 
 void CommunicationMonkeyPart::connectionError(QAbstractSocket::SocketError err)
@@ -214,49 +533,112 @@ void CommunicationMonkeyPart::connectionError(QAbstractSocket::SocketError err)
     qWarning("%s: err %d\n", Q_FUNC_INFO, static_cast<int>(err));
     if (err == QAbstractSocket::RemoteHostClosedError)
         return;
-    emit error((curClient_ != nullptr)
-                   ? curClient_->errorString()
+    Session *session = senderSession();
+    emit error((session != nullptr)
+                   ? session->sock->errorString()
                    : T_("socket err: %1").arg(static_cast<int>(err)));
 }
 
-void CommunicationMonkeyPart::sendCommand(PacketTypeForAgent pt,
-                                          const QString &data)
+void CommunicationMonkeyPart::localConnectionError(
+    QLocalSocket::LocalSocketError err)
 {
-    sendBuf_.append(createPacket(static_cast<uint32_t>(pt), data));
-    flushSendData();
+    qWarning("%s: err %d\n", Q_FUNC_INFO, static_cast<int>(err));
+    if (err == QLocalSocket::PeerClosedError)
+        return;
+    Session *session = senderSession();
+    emit error((session != nullptr)
+                   ? session->sock->errorString()
+                   : T_("socket err: %1").arg(static_cast<int>(err)));
 }
 
-bool CommunicationMonkeyPart::isConnectedState() const
+void CommunicationMonkeyPart::sendCommand(int sessionId, PacketTypeForAgent pt,
+                                          QString text)
 {
-    return curClient_ != nullptr
-           && curClient_->state() == QAbstractSocket::ConnectedState;
+    Session *session = sessionById(sessionId);
+    if (session == nullptr) {
+        qWarning("%s: no session %d", Q_FUNC_INFO, sessionId);
+        return;
+    }
+    session->pending.push_back(PendingPacket{pt, std::move(text)});
+    flushSendData(*session);
+}
+
+bool CommunicationMonkeyPart::isConnectedState(int sessionId) const
+{
+    const Session *session = sessionById(sessionId);
+    return session != nullptr && isSocketConnected(session->sock);
+}
+
+int CommunicationMonkeyPart::findSession(const QString &processName) const
+{
+    if (processName.isEmpty()) {
+        const Session *session = sessionById(mainSessionId_);
+        if (session != nullptr && session->ready
+            && isSocketConnected(session->sock))
+            return mainSessionId_;
+        return invalidSession;
+    }
+    for (const std::unique_ptr<Session> &session : sessions_)
+        if (session->ready && session->name == processName
+            && isSocketConnected(session->sock))
+            return session->id;
+    return invalidSession;
+}
+
+QString CommunicationMonkeyPart::sessionName(int sessionId) const
+{
+    const Session *session = sessionById(sessionId);
+    return session != nullptr ? session->name : QString();
+}
+
+bool CommunicationMonkeyPart::agentHasCapability(int sessionId,
+                                                 Capability cap) const
+{
+    const Session *session = sessionById(sessionId);
+    return session != nullptr
+           && (session->capabilities & static_cast<uint32_t>(cap)) != 0;
 }
 
 void CommunicationMonkeyPart::close()
 {
-    assert(controlSock_.get() != nullptr);
-    if (controlSock_->isListening())
+    assert(controlSock_ != nullptr || localControlSock_ != nullptr);
+    // sockets are owned by servers
+    sessions_.clear();
+    if (controlSock_ != nullptr && controlSock_->isListening())
         controlSock_->close();
     controlSock_.reset(nullptr);
+    if (localControlSock_ != nullptr && localControlSock_->isListening())
+        localControlSock_->close();
+    localControlSock_.reset(nullptr);
+}
+
+CommunicationAgentPart::CommunicationAgentPart(QObject *parent)
+    : QObject(parent),
+      wakeupEventType_(static_cast<QEvent::Type>(QEvent::registerEventType()))
+{
 }
 
 bool CommunicationAgentPart::connectToMonkey()
 {
-    assert(sock_.state() == QAbstractSocket::UnconnectedState
-           && !timer_.isActive());
-    assert(sock_.thread() == thread());
+    assert(sock_ == nullptr);
     assert(thread() == QThread::currentThread());
-    if (sock_.state() != QAbstractSocket::UnconnectedState) {
+    if (sock_ != nullptr) {
         qWarning("%s: you try connect socket in not inital state\n",
                  Q_FUNC_INFO);
         return false;
     }
 
-    connect(&sock_, SIGNAL(bytesWritten(qint64)), this, SLOT(sendData()));
-    connect(&sock_, SIGNAL(connected()), this, SLOT(sendData()));
-    connect(&sock_, SIGNAL(readyRead()), this, SLOT(readCommands()));
-    connect(&sock_, SIGNAL(error(QAbstractSocket::SocketError)), this,
-            SLOT(connectionError(QAbstractSocket::SocketError)));
+    const QByteArray socketName = qgetenv(QTMONKEY_SOCKET_ENV_NAME);
+    if (!socketName.isEmpty()) {
+        DBGPRINT("%s: local socket %s", Q_FUNC_INFO, socketName.constData());
+        auto sock = new QLocalSocket(this);
+        sock_ = sock;
+        connect(sock, SIGNAL(error(QLocalSocket::LocalSocketError)), this,
+                SLOT(localConnectionError(QLocalSocket::LocalSocketError)));
+        setupSocket();
+        sock->connectToServer(QString::fromLocal8Bit(socketName));
+        return true;
+    }
 
     QByteArray portnoStr = qgetenv(QTMONKEY_PORT_ENV_NAME);
     bool ok = false;
@@ -264,8 +646,12 @@ bool CommunicationAgentPart::connectToMonkey()
 
     if (ok && portno <= 0xFFFFu) {
         DBGPRINT("%s: portno %d", Q_FUNC_INFO, static_cast<int>(portno));
-        sock_.connectToHost(QHostAddress::LocalHost, portno);
-        timer_.start(200, this);
+        auto sock = new QTcpSocket(this);
+        sock_ = sock;
+        connect(sock, SIGNAL(error(QAbstractSocket::SocketError)), this,
+                SLOT(connectionError(QAbstractSocket::SocketError)));
+        setupSocket();
+        sock->connectToHost(QHostAddress::LocalHost, portno);
         return true;
     } else {
         qWarning("%s: QTMONKEY_PORT(%s) %s", Q_FUNC_INFO, portnoStr.data(),
@@ -275,6 +661,17 @@ bool CommunicationAgentPart::connectToMonkey()
     }
 }
 
+void CommunicationAgentPart::setupSocket()
+{
+    assert(sock_ != nullptr);
+    connect(sock_, SIGNAL(bytesWritten(qint64)), this, SLOT(sendData()));
+    connect(sock_, SIGNAL(connected()), this, SLOT(sendData()));
+    connect(sock_, SIGNAL(readyRead()), this, SLOT(readCommands()));
+    // will be sent just after connection established
+    sendCommand(PacketTypeForMonkey::Hello,
+                helloText(agentCapabilities, agentProcessName()));
+}
+
 bool CommunicationAgentPart::hasCloseAck()
 {
     return close_ack_.testAndSetOrdered(1, 0);
@@ -282,49 +679,57 @@ bool CommunicationAgentPart::hasCloseAck()
 
 void CommunicationAgentPart::readCommands()
 {
-    assert(sock_.state() == QAbstractSocket::ConnectedState);
-    const qint64 nBytes = sock_.bytesAvailable();
-    if (nBytes <= 0) {
-        qWarning("%s: no data availabile: %lld\n", Q_FUNC_INFO,
-                 static_cast<long long>(nBytes));
-        return;
-    }
-    const auto wasSize = recvBuf_.size();
-    recvBuf_.resize(wasSize + nBytes);
-    const qint64 readBytes = sock_.read(recvBuf_.data() + wasSize, nBytes);
-    if (readBytes <= 0) {
-        qWarning("%s: read data error", Q_FUNC_INFO);
-        recvBuf_.resize(wasSize);
-        emit error(T_("Can not read data from client"));
-        return;
-    }
-    if (nBytes != readBytes)
-        recvBuf_.resize(wasSize + readBytes);
-    bool done;
-    do {
-        done = true;
-        switch (calcPacketState(recvBuf_)) {
-        case PacketState::Damaged:
+    assert(isSocketConnected(sock_));
+    // handler of runScript runs script inside of this slot and processes
+    // events, but readyRead is not emitted recursively, so data that arrived
+    // during script (for example next queued script) is read here
+    for (;;) {
+        const qint64 nBytes = sock_->bytesAvailable();
+        if (nBytes > 0 && recvBuf_.readFrom(*sock_, nBytes) <= 0) {
+            qWarning("%s: read data error", Q_FUNC_INFO);
+            emit error(T_("Can not read data from client"));
+            return;
+        }
+        switch (recvBuf_.state()) {
+        case PacketReader::State::Damaged:
             qWarning("%s: packet damaged", Q_FUNC_INFO);
             emit error(T_("packet for qmonkey's agent damaged"));
-            break;
-        case PacketState::NotReady:
-            /*nothing*/ break;
-        case PacketState::Ready: {
-            auto packet = extractFromPacket(recvBuf_);
-            done = recvBuf_.isEmpty();
+            return;
+        case PacketReader::State::NotReady:
+            /*nothing*/ return;
+        case PacketReader::State::Ready: {
+            auto packet = recvBuf_.take();
             switch (static_cast<PacketTypeForAgent>(packet.first)) {
             case PacketTypeForAgent::RunScript:
+            case PacketTypeForAgent::RunQueuedScript: {
                 DBGPRINT("%s: get script: '%s'", Q_FUNC_INFO,
                          qPrintable(packet.second));
+                const bool moreScriptsQueued
+                    = static_cast<PacketTypeForAgent>(packet.first)
+                      == PacketTypeForAgent::RunQueuedScript;
                 if (currentScriptFileName_.isEmpty()) {
-                    emit runScript(Script{std::move(packet.second)});
+                    emit runScript(Script{std::move(packet.second)},
+                                   moreScriptsQueued);
                 } else {
                     emit runScript(Script{currentScriptFileName_, 1,
-                                          std::move(packet.second)});
+                                          std::move(packet.second)},
+                                   moreScriptsQueued);
                     currentScriptFileName_.clear();
                 }
                 break;
+            }
+            case PacketTypeForAgent::Hello: {
+                QString monkeyName;
+                if (!parseHello(packet.second, monkeyCapabilities_,
+                                monkeyName)) {
+                    emit error(T_("invalid hello from qtmonkey: %1")
+                                   .arg(packet.second));
+                    break;
+                }
+                DBGPRINT("%s: monkey capabilities %x", Q_FUNC_INFO,
+                         static_cast<unsigned>(monkeyCapabilities_));
+                break;
+            }
             case PacketTypeForAgent::SetScriptFileName:
                 DBGPRINT("%s: script file name now '%s'", Q_FUNC_INFO,
                          qPrintable(packet.second));
@@ -339,52 +744,111 @@ void CommunicationAgentPart::readCommands()
                 emit error(T_("unknown type of packet for qtmonkey's agent"));
                 break;
             }
+            // connection may be lost while script runs
+            if (!isSocketConnected(sock_))
+                return;
         }
         }
-    } while (!done);
+    }
 }
 
 void CommunicationAgentPart::connectionError(QAbstractSocket::SocketError err)
 {
     qWarning("%s: err %d\n", Q_FUNC_INFO, static_cast<int>(err));
-    emit error(sock_.errorString());
+    emit error(sock_->errorString());
+}
+
+void CommunicationAgentPart::localConnectionError(
+    QLocalSocket::LocalSocketError err)
+{
+    qWarning("%s: err %d\n", Q_FUNC_INFO, static_cast<int>(err));
+    emit error(sock_->errorString());
 }
 
-void CommunicationAgentPart::timerEvent(QTimerEvent *event)
+void CommunicationAgentPart::customEvent(QEvent *event)
 {
-    assert(event->timerId() == timer_.timerId());
-    if (event->timerId() != timer_.timerId())
+    if (event->type() != wakeupEventType_)
         return;
     sendData();
 }
 
 void CommunicationAgentPart::sendData()
 {
-    {
-        auto sendBuf = sendBuf_.get();
-        if (sock_.state() != QAbstractSocket::ConnectedState
-            || sendBuf->isEmpty())
-            return;
-        qint64 nBytes = sock_.write(*sendBuf);
-        if (nBytes == -1) {
-            qWarning("%s: write to socket failed %s", Q_FUNC_INFO,
-                     qPrintable(sock_.errorString()));
-            return;
+    assert(thread() == QThread::currentThread());
+    // encode outside of lock, so producers never wait for it.
+    // Big packets are encoded by fragments and only if socket
+    // has not too much data to write, so we never keep whole encoded copy
+    // of big packet in memory
+    const auto now = std::chrono::steady_clock::now();
+    while (sendBuf_.size() + (sock_ != nullptr ? sock_->bytesToWrite() : 0)
+           < maxBufferedBytes) {
+        if (takenPos_ == takenPending_.size()) {
+            takenPending_.clear();
+            takenPos_ = 0;
+            {
+                auto pending = pending_.get();
+                takenPending_.swap(*pending);
+            }
+            if (takenPending_.empty())
+                break;
+        }
+        PendingPacket &packet = takenPending_[takenPos_];
+        if (textPos_ == 0) {
+            const auto latency
+                = std::chrono::duration_cast<std::chrono::microseconds>(
+                    now - packet.queuedAt);
+            stats_.totalQueueLatency += latency;
+            stats_.maxQueueLatency = std::max(stats_.maxQueueLatency, latency);
         }
-        sendBuf->remove(0, nBytes);
+        textPos_ = appendPacketFragment(
+            sendBuf_, static_cast<uint32_t>(packet.type), packet.text, textPos_);
+        if (textPos_ == packet.text.size()) {
+            packet.text.clear();
+            textPos_ = 0;
+            ++takenPos_;
+            ++stats_.packets;
+        }
+    }
+
+    if (!isSocketConnected(sock_) || sendBuf_.isEmpty())
+        return;
+    const qint64 nBytes = sock_->write(sendBuf_);
+    if (nBytes == -1) {
+        qWarning("%s: write to socket failed %s", Q_FUNC_INFO,
+                 qPrintable(sock_->errorString()));
+        return;
     }
-    sock_.flush();
+    ++stats_.writes;
+    DBGPRINT("%s: %llu packets in %llu writes, avg latency %lld us",
+             Q_FUNC_INFO, static_cast<unsigned long long>(stats_.packets),
+             static_cast<unsigned long long>(stats_.writes),
+             static_cast<long long>(stats_.totalQueueLatency.count()
+                                    / std::max<uint64_t>(stats_.packets, 1)));
+    sendBuf_.remove(0, static_cast<int>(nBytes));
+    flushSocket(*sock_);
 }
 
-void CommunicationAgentPart::sendCommand(PacketTypeForMonkey pt,
-                                         const QString &text)
+void CommunicationAgentPart::sendCommand(PacketTypeForMonkey pt, QString text)
 {
-    sendBuf_.get()->append(createPacket(static_cast<uint32_t>(pt), text));
+    bool wasEmpty;
+    {
+        auto pending = pending_.get();
+        wasEmpty = pending->empty();
+        pending->push_back(PendingPacket{pt, std::move(text),
+                                         std::chrono::steady_clock::now()});
+    }
+    // if queue was not empty, wakeup is already posted
+    if (wasEmpty)
+        QCoreApplication::postEvent(this, new QEvent(wakeupEventType_));
 }
 
 void CommunicationAgentPart::flushSendData()
 {
     sendData();
-    if (sock_.state() == QAbstractSocket::ConnectedState)
-        sock_.flush();
+    // rest of big packet is encoded only after write of previous fragments
+    while (hasDataToSend() && isSocketConnected(sock_)
+           && sock_->waitForBytesWritten(1000 /*ms*/))
+        sendData();
+    if (isSocketConnected(sock_))
+        flushSocket(*sock_);
 }
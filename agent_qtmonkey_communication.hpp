@@ -1,16 +1,28 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
+#include <deque>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include <QAtomicInt>
 #include <QtCore/QBasicTimer>
+#include <QtCore/QByteArray>
+#include <QtCore/QEvent>
 #include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
 #include <QtNetwork/QTcpServer>
 #include <QtNetwork/QTcpSocket>
 
 #include "shared_resource.hpp"
 
+class QIODevice;
+class QTextDecoder;
+
 namespace qt_monkey_agent
 {
 namespace Private
@@ -26,6 +38,13 @@ enum class PacketTypeForAgent : uint32_t {
     ContinueScript,
     HaltScript,
     CloseAck,
+    //! version and capabilities of monkey, answer to agent's Hello
+    Hello,
+    /**
+     * Like RunScript, but monkey already sent next script,
+     * so agent should not wait for GUI after this one
+     */
+    RunQueuedScript,
 };
 
 enum class PacketTypeForMonkey : uint32_t {
@@ -36,8 +55,95 @@ enum class PacketTypeForMonkey : uint32_t {
     // TODO: may be need?
     ScriptStopOnBreakPoint,
     Close,
+    //! version and capabilities of agent, sent just after connection
+    Hello,
+};
+
+//! version of protocol, sent in Hello packets
+static const uint32_t protocolVersion = 1;
+
+//! bits of capabilities mask from Hello packet
+enum class Capability : uint32_t {
+    /**
+     * agent: accept scripts while previous one still running and
+     * run them one by one, reporting ScriptEnd for each one;
+     * monkey: can send RunQueuedScript
+     */
+    ScriptQueue = 1u << 0,
+};
+
+/**
+ * If set in type of packet, then it is not last fragment of message,
+ * fragments of one message go one after another and have the same type.
+ * So size of message is not limited by size of packet.
+ */
+static const uint32_t packetTypeContinuation = 0x80000000u;
+
+/**
+ * Buffer for received data. Packets are extracted without shifting of data
+ * after each packet: read position moves forward, and buffer is compacted
+ * only before next read and only if consumed part is not smaller than
+ * unread one, so extraction of packets is amortized O(1) per byte.
+ * Fragments of message are decoded as soon as they received,
+ * so only decoded part of big message and the last fragment are kept in memory.
+ */
+class PacketReader final
+{
+public:
+    enum class State { Damaged, NotReady, Ready };
+
+    PacketReader();
+    ~PacketReader();
+    PacketReader(const PacketReader &) = delete;
+    PacketReader &operator=(const PacketReader &) = delete;
+    /**
+     * Read data from device
+     * @return number of read bytes or -1 in case of error
+     */
+    qint64 readFrom(QIODevice &dev, qint64 nBytes);
+    void append(const char *data, int len);
+    //! consume all received not last fragments of message
+    State state();
+    /**
+     * @pre state() == State::Ready
+     * @return type of message without packetTypeContinuation and its text
+     */
+    std::pair<uint32_t, QString> take();
+    //! @return true if there is no received and not consumed data
+    bool isEmpty() const { return readPos_ == buf_.size(); }
+    void clear();
+
+private:
+    QByteArray buf_;
+    int readPos_ = 0;
+    //@{
+    //! not completed message, decoder is not null if there is one
+    std::unique_ptr<QTextDecoder> decoder_;
+    uint32_t messageType_ = 0;
+    QString message_;
+    //@}
+
+    //! state of next packet, without assembling of message
+    State packetState() const;
+    void compact();
 };
 
+/**
+ * Transport between monkey and agent, monkey choose it according to
+ * QTMONKEY_TRANSPORT environment variable (tcp or local), and pass address
+ * of server to agent via environment of process
+ */
+enum class Transport {
+    Tcp,
+    //! QLocalSocket: unix domain socket or named pipe on Windows
+    Local,
+};
+
+/**
+ * Monkey side of communication. Several agents may be connected at once,
+ * for example if application consists of several processes,
+ * each agent has its own session.
+ */
 class CommunicationMonkeyPart
 #ifndef Q_MOC_RUN
     final
@@ -46,17 +152,44 @@ class CommunicationMonkeyPart
 {
     Q_OBJECT
 signals:
-    void newUserAppEvent(QString);
-    void scriptError(QString);
-    void scriptEnd();
-    void scriptLog(QString);
+    //@{
+    //! sessionId is id of agent that sent packet
+    void newUserAppEvent(int sessionId, QString);
+    void scriptError(int sessionId, QString);
+    void scriptEnd(int sessionId);
+    void scriptLog(int sessionId, QString);
+    //@}
     void error(QString);
+    /**
+     * connected agent sent Hello or did not send it in time,
+     * before that session is not returned by findSession
+     */
     void agentReadyToRunScript();
+    void agentDisconnected(int sessionId);
 
 public:
+    static const int invalidSession = -1;
+
     explicit CommunicationMonkeyPart(QObject *parent = nullptr);
-    void sendCommand(PacketTypeForAgent pt, const QString &);
-    bool isConnectedState() const;
+    ~CommunicationMonkeyPart();
+    /**
+     * Queue packet for agent, big text is encoded by fragments
+     * while socket sends previous ones, so pass it by std::move
+     */
+    void sendCommand(int sessionId, PacketTypeForAgent pt, QString text);
+    bool isConnectedState(int sessionId) const;
+    /**
+     * Find connected agent, that is ready to run scripts
+     * @param processName name of process from agent's Hello,
+     * empty name means main process: agent that connected first,
+     * when there was no connected main process
+     * @return id of session or invalidSession
+     */
+    int findSession(const QString &processName) const;
+    //! @return name of process from Hello or empty string
+    QString sessionName(int sessionId) const;
+    //! capabilities of connected agent, 0 until its Hello received
+    bool agentHasCapability(int sessionId, Capability cap) const;
     void close();
     const std::pair<QString, QString> &requiredProcessEnvironment() const
     {
@@ -68,13 +201,45 @@ private slots:
     void flushSendData();
     void clientDisconnected();
     void connectionError(QAbstractSocket::SocketError);
+    void localConnectionError(QLocalSocket::LocalSocketError);
 
 private:
+    struct PendingPacket final {
+        PacketTypeForAgent type;
+        QString text;
+    };
+    struct Session final {
+        int id;
+        //! QTcpSocket or QLocalSocket
+        QIODevice *sock;
+        //! encoded, but not written yet data
+        QByteArray sendBuf;
+        //! not encoded yet packets
+        std::deque<PendingPacket> pending;
+        //! position in text of pending.front() for next fragment
+        int textPos = 0;
+        PacketReader recvBuf;
+        uint32_t capabilities = 0;
+        QString name;
+        //! Hello received or waiting for it is over
+        bool ready = false;
+        QBasicTimer waitHello;
+    };
+    Transport transport_;
     std::unique_ptr<QTcpServer> controlSock_;
-    QTcpSocket *curClient_ = nullptr;
-    QByteArray sendBuf_;
-    QByteArray recvBuf_;
+    std::unique_ptr<QLocalServer> localControlSock_;
+    std::vector<std::unique_ptr<Session>> sessions_;
+    int nextSessionId_ = 0;
+    int mainSessionId_ = invalidSession;
     std::pair<QString, QString> envPrefs_;
+
+    Session *sessionById(int sessionId) const;
+    //! @return session of sender of signal
+    Session *senderSession() const;
+    void flushSendData(Session &session);
+    void handlePacket(Session &session, uint32_t type, QString text);
+    void setReady(Session &session);
+    void timerEvent(QTimerEvent *event) override;
 };
 
 class CommunicationAgentPart
@@ -86,31 +251,82 @@ class CommunicationAgentPart
     Q_OBJECT
 signals:
     void error(const QString &);
-    void runScript(const qt_monkey_agent::Private::Script &);
+    /**
+     * @param moreScriptsQueued if true, then monkey already sent next script,
+     * so no need to wait for GUI after this one
+     */
+    void runScript(const qt_monkey_agent::Private::Script &,
+                   bool moreScriptsQueued);
 
 public:
-    explicit CommunicationAgentPart(QObject *parent = nullptr) : QObject(parent)
-    {
-    }
-    void sendCommand(PacketTypeForMonkey pt, const QString &);
+    //! statistic of sending, to tune flush policy
+    struct SendStats final {
+        uint64_t packets = 0;
+        uint64_t writes = 0;
+        //! time between sendCommand and encoding of packet for write
+        std::chrono::microseconds totalQueueLatency{0};
+        std::chrono::microseconds maxQueueLatency{0};
+    };
+
+    explicit CommunicationAgentPart(QObject *parent = nullptr);
+    /**
+     * Thread-safe, do not wait for socket I/O.
+     * If queue was empty, wake up thread of this object, all packets
+     * queued before it handle wakeup are sent with one write
+     */
+    void sendCommand(PacketTypeForMonkey pt, QString text);
     bool connectToMonkey();
     void flushSendData();
     bool hasCloseAck();
+    //! should be used only from thread of this object
+    const SendStats &sendStats() const { return stats_; }
+    //! capabilities of monkey, 0 until its Hello received
+    bool monkeyHasCapability(Capability cap) const
+    {
+        return (monkeyCapabilities_ & static_cast<uint32_t>(cap)) != 0;
+    }
 
 private slots:
     void sendData();
     void readCommands();
     void connectionError(QAbstractSocket::SocketError);
+    void localConnectionError(QLocalSocket::LocalSocketError);
 
 private:
-    QTcpSocket sock_;
-    QBasicTimer timer_;
-    qt_monkey_common::SharedResource<QByteArray> sendBuf_;
-    QByteArray recvBuf_;
+    struct PendingPacket final {
+        PacketTypeForMonkey type;
+        QString text;
+        std::chrono::steady_clock::time_point queuedAt;
+    };
+    //! QTcpSocket or QLocalSocket, created in connectToMonkey
+    QIODevice *sock_ = nullptr;
+    QEvent::Type wakeupEventType_;
+    /**
+     * Double buffer: producers append to pending list under short lock,
+     * agent thread swaps it with empty one and encodes packets
+     * without lock
+     */
+    qt_monkey_common::SharedResource<std::vector<PendingPacket>> pending_;
+    std::vector<PendingPacket> takenPending_;
+    //! already sent part of takenPending_
+    size_t takenPos_ = 0;
+    //! position in text of takenPending_[takenPos_] for next fragment
+    int textPos_ = 0;
+    //! encoded, but not written yet data, used only in agent thread
+    QByteArray sendBuf_;
+    PacketReader recvBuf_;
     QString currentScriptFileName_;
     QAtomicInt close_ack_{0};
+    SendStats stats_;
+    uint32_t monkeyCapabilities_ = 0;
 
-    void timerEvent(QTimerEvent *) override;
+    //! connect signals of sock_ and queue Hello packet
+    void setupSocket();
+    bool hasDataToSend() const
+    {
+        return !sendBuf_.isEmpty() || takenPos_ < takenPending_.size();
+    }
+    void customEvent(QEvent *event) override;
 };
 } // namespace Private
 } // namespace qt_monkey_agent
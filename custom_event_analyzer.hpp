@@ -1,10 +1,15 @@
 #pragma once
 
+#include <QtCore/QByteArray>
+#include <QtCore/QEvent>
 #include <QtCore/QString>
+#include <cstddef>
 #include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 class QWidget;
-class QEvent;
 class QObject;
 
 namespace qt_monkey_agent
@@ -26,15 +31,69 @@ struct EventInfo final {
     QString widgetName; //!< may contains cached value of name of obj
     const GenerateCommand
         &codeGenerator; //!< may be used by analyzer for async code generation
+    QWidget *matchedWidget; //!< widget or its parent that matched class
+                            //!< filter of analyzer, null if there is no filter
 };
 
 /**
+ * Analyzer of events, it is function that
  * return not empty string [QString] with javascript code if can handle this
  * event
  * it is possible to return javascript comments to prevent javascript code
  * generation and wait another event, for example on key press return comment
  * and on key release return real code
- * @tparam const EventInfo & information about event
+ * To not slow down application analyzer should declare types of events
+ * that it can handle, by default it is called for all events.
  */
-using CustomEventAnalyzer = std::function<QString(const EventInfo &)>;
+class CustomEventAnalyzer final
+{
+public:
+    //! @param const EventInfo & information about event
+    using Function = std::function<QString(const EventInfo &)>;
+
+    //! analyzer which is called for all events
+    template <typename Func,
+              typename = typename std::enable_if<!std::is_same<
+                  typename std::decay<Func>::type,
+                  CustomEventAnalyzer>::value>::type>
+    CustomEventAnalyzer(Func &&func) : func_(std::forward<Func>(func))
+    {
+    }
+    //! analyzer which is called only for events with such types
+    CustomEventAnalyzer(Function func, std::vector<QEvent::Type> eventTypes)
+        : func_(std::move(func)), eventTypes_(std::move(eventTypes))
+    {
+    }
+    /**
+     * analyzer which is called only for events with such types and only
+     * if widget of event or one of its parents inherits class with such name
+     * @param className name of class, like "QTreeView"
+     * @param maxDepth how many widgets check, starting from widget of event,
+     * 1 means do not check parents
+     */
+    CustomEventAnalyzer(Function func, std::vector<QEvent::Type> eventTypes,
+                        const char *className,
+                        size_t maxDepth = unlimitedDepth)
+        : func_(std::move(func)), eventTypes_(std::move(eventTypes)),
+          className_(className), maxDepth_(maxDepth)
+    {
+    }
+    QString operator()(const EventInfo &eventInfo) const
+    {
+        return func_(eventInfo);
+    }
+    //! empty if analyzer should be called for all events
+    const std::vector<QEvent::Type> &eventTypes() const { return eventTypes_; }
+    //! empty if there is no class filter
+    const QByteArray &className() const { return className_; }
+    size_t maxDepth() const { return maxDepth_; }
+
+    static constexpr size_t unlimitedDepth = static_cast<size_t>(-1);
+
+private:
+    Function func_;
+    std::vector<QEvent::Type> eventTypes_;
+    QByteArray className_;
+    size_t maxDepth_ = unlimitedDepth;
+};
 } // namespace qt_monkey_agent
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <functional>
+#include <utility>
+
+#include <QApplication>
+#include <QWidget>
+#include <QtCore/QThread>
+#include <QtCore/QTimerEvent>
+
+namespace qt_monkey_agent
+{
+namespace Private
+{
+/**
+ * Snapshot of GUI thread's event loop state, used to find out that
+ * some code started nested event loop (modal dialog, menu and so on).
+ * Should be used only in GUI thread.
+ */
+class EventLoopState final
+{
+public:
+    void remember()
+    {
+#if QT_VERSION >= 0x050500
+        loopLevel_ = QThread::currentThread()->loopLevel();
+#else
+        modalWidget_ = qApp->activeModalWidget();
+        popupWidget_ = qApp->activePopupWidget();
+#endif
+    }
+    //! @return true if now we are inside event loop started after remember
+    bool inNestedLoop() const
+    {
+#if QT_VERSION >= 0x050500
+        return QThread::currentThread()->loopLevel() > loopLevel_;
+#else
+        return qApp->activeModalWidget() != modalWidget_
+               || qApp->activePopupWidget() != popupWidget_;
+#endif
+    }
+
+private:
+#if QT_VERSION >= 0x050500
+    int loopLevel_ = 0;
+#else
+    QWidget *modalWidget_ = nullptr;
+    QWidget *popupWidget_ = nullptr;
+#endif
+};
+
+/**
+ * Watch for nested event loop while code runs in GUI thread.
+ * Check is done by timer, so it happens only when code runs event loop
+ * (nested one or just processEvents), and code that calls processEvents
+ * in a loop is not turned into busy spin.
+ * Should be created in GUI thread just before code to watch,
+ * and destroyed after it.
+ */
+class NestedLoopWatcher final : public QObject
+{
+public:
+    //! @param onNested called once, when nested loop detected
+    explicit NestedLoopWatcher(std::function<void()> onNested)
+        : onNested_(std::move(onNested))
+    {
+        loopState_.remember();
+        timerId_ = startTimer(checkIntervalMs);
+    }
+    NestedLoopWatcher(const NestedLoopWatcher &) = delete;
+    NestedLoopWatcher &operator=(const NestedLoopWatcher &) = delete;
+    ~NestedLoopWatcher()
+    {
+        if (timerId_ != 0)
+            killTimer(timerId_);
+    }
+
+protected:
+    void timerEvent(QTimerEvent *event) override
+    {
+        if (event->timerId() != timerId_) {
+            QObject::timerEvent(event);
+            return;
+        }
+        if (!loopState_.inNestedLoop())
+            return;
+        killTimer(timerId_);
+        timerId_ = 0;
+        onNested_();
+    }
+
+private:
+    static constexpr int checkIntervalMs = 10;
+    std::function<void()> onNested_;
+    EventLoopState loopState_;
+    int timerId_ = 0;
+};
+} // namespace Private
+} // namespace qt_monkey_agent
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <QtCore/QEvent>
+
+namespace qt_monkey_agent
+{
+namespace Private
+{
+/**
+ * Callable without arguments and result, like std::function<void()>,
+ * but functors that fit into inline buffer are stored without memory
+ * allocation. Not copyable and not movable, it lives inside event.
+ */
+class InlineTask final
+{
+public:
+    //! enough for several pointers plus std::function or shared_ptr
+    static constexpr size_t capacity = 96;
+
+    template <typename Func> explicit InlineTask(Func &&func)
+    {
+        using F = typename std::decay<Func>::type;
+        init<F>(std::forward<Func>(func),
+                std::integral_constant<bool, fitsInline<F>()>());
+    }
+    InlineTask(const InlineTask &) = delete;
+    InlineTask &operator=(const InlineTask &) = delete;
+    ~InlineTask() { destroy_(&storage_); }
+    void operator()() { invoke_(&storage_); }
+
+private:
+    using Storage = typename std::aligned_storage<capacity>::type;
+    Storage storage_;
+    void (*invoke_)(void *);
+    void (*destroy_)(void *);
+
+    template <typename F> static constexpr bool fitsInline()
+    {
+        return sizeof(F) <= sizeof(Storage)
+               && std::alignment_of<Storage>::value % std::alignment_of<F>::value
+                      == 0;
+    }
+    template <typename F, typename Func>
+    void init(Func &&func, std::true_type /*inline*/)
+    {
+        new (&storage_) F(std::forward<Func>(func));
+        invoke_ = [](void *p) { (*static_cast<F *>(p))(); };
+        destroy_ = [](void *p) { static_cast<F *>(p)->~F(); };
+    }
+    template <typename F, typename Func>
+    void init(Func &&func, std::false_type /*inline*/)
+    {
+        // too big functor, store it in heap
+        new (&storage_) F *(new F(std::forward<Func>(func)));
+        invoke_ = [](void *p) { (**static_cast<F **>(p))(); };
+        destroy_ = [](void *p) { delete *static_cast<F **>(p); };
+    }
+};
+
+/**
+ * Event to run function in thread of receiver,
+ * memory of events is reused, so in steady state posting of event
+ * with small functor do not allocate memory
+ */
+class FuncEvent final : public QEvent
+{
+public:
+    template <typename Func>
+    FuncEvent(QEvent::Type type, Func &&func)
+        : QEvent(type), func_(std::forward<Func>(func))
+    {
+    }
+    void exec() { func_(); }
+
+    //@{
+    //! events created in one thread and deleted by Qt in another
+    static void *operator new(size_t size)
+    {
+        assert(size == sizeof(FuncEvent));
+        {
+            Pool &p = pool();
+            std::lock_guard<std::mutex> lock{p.mutex};
+            if (!p.free.empty()) {
+                void *mem = p.free.back();
+                p.free.pop_back();
+                return mem;
+            }
+        }
+        return ::operator new(size);
+    }
+    static void operator delete(void *mem)
+    {
+        {
+            Pool &p = pool();
+            std::lock_guard<std::mutex> lock{p.mutex};
+            if (p.free.size() < maxPooled) {
+                p.free.push_back(mem);
+                return;
+            }
+        }
+        ::operator delete(mem);
+    }
+    //@}
+private:
+    //! usually there are only few events in flight
+    static constexpr size_t maxPooled = 64;
+    struct Pool final {
+        Pool() { free.reserve(maxPooled); }
+        std::mutex mutex;
+        std::vector<void *> free;
+    };
+    static Pool &pool()
+    {
+        // never destroyed: Qt can delete not delivered events
+        // after destruction of static objects
+        static Pool *p = new Pool;
+        return *p;
+    }
+
+    InlineTask func_;
+};
+} // namespace Private
+} // namespace qt_monkey_agent
@@ -0,0 +1,137 @@
+#include "output_batcher.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using qt_monkey_app::OutputBatcher;
+
+void OutputBatcher::append(const char *data, size_t len, int64_t nowMs)
+{
+    if (len == 0)
+        return;
+    if (empty())
+        firstByteMs_ = nowMs;
+    const char *const end = data + len;
+    while (data != end) {
+        auto eol = static_cast<const char *>(
+            std::memchr(data, '\n', static_cast<size_t>(end - data)));
+        const char *const chunkEnd = eol != nullptr ? eol + 1 : end;
+        const size_t chunkLen = static_cast<size_t>(chunkEnd - data);
+        if (atLineStart_) {
+            atLineStart_ = false;
+            partialLineMs_ = nowMs;
+            droppingLine_ = budget_.exhausted(nowMs);
+            if (droppingLine_)
+                ++droppedSinceReport_;
+            else if (opts_.timestamps)
+                appendTimestamp(nowMs);
+        }
+        if (droppingLine_) {
+            droppedBytesSinceReport_ += chunkLen;
+        } else {
+            const size_t n = budget_.take(nowMs, chunkLen);
+            pending_.append(data, n);
+            if (n < chunkLen) {
+                // cut line, so long line or output without line breaks
+                // can not pass over budget
+                droppingLine_ = true;
+                ++droppedSinceReport_;
+                droppedBytesSinceReport_ += chunkLen - n;
+                pending_ += '\n';
+                completeSize_ = pending_.size();
+            }
+        }
+        if (eol != nullptr) {
+            atLineStart_ = true;
+            if (!droppingLine_)
+                completeSize_ = pending_.size();
+        }
+        data = chunkEnd;
+    }
+}
+
+bool OutputBatcher::batchReady(int64_t nowMs) const
+{
+    if (pending_.size() >= opts_.maxBatchSize)
+        return true;
+    return !empty() && nowMs - firstByteMs_ >= opts_.windowMs;
+}
+
+void OutputBatcher::flush(int64_t nowMs, bool force, const OnBatch &onBatch)
+{
+    size_t toSend = completeSize_;
+    // not completed line can not wait forever
+    if (force || pending_.size() >= opts_.maxBatchSize
+        || nowMs - partialLineMs_ >= opts_.windowMs)
+        toSend = pending_.size();
+    if (droppedSinceReport_ > 0 && toSend == pending_.size()) {
+        if (toSend > 0 && pending_[toSend - 1] != '\n') {
+            // summary should be on its own line
+            pending_ += '\n';
+            atLineStart_ = true;
+        }
+        appendDropSummary();
+        toSend = pending_.size();
+    }
+    if (toSend == 0)
+        return;
+    onBatch(pending_.data(), toSend);
+    pending_.erase(0, toSend);
+    completeSize_ = 0;
+    // rest is not completed line, it is sent when its window ends
+    firstByteMs_ = partialLineMs_;
+}
+
+void OutputBatcher::Budget::startNewSecond(int64_t nowMs)
+{
+    if (nowMs - startMs_ >= 1000) {
+        startMs_ = nowMs;
+        used_ = 0;
+    }
+}
+
+bool OutputBatcher::Budget::exhausted(int64_t nowMs)
+{
+    if (bytesPerSecond_ == 0)
+        return false;
+    startNewSecond(nowMs);
+    return used_ >= bytesPerSecond_;
+}
+
+size_t OutputBatcher::Budget::take(int64_t nowMs, size_t len)
+{
+    if (bytesPerSecond_ == 0)
+        return len;
+    startNewSecond(nowMs);
+    const size_t n = std::min(len, bytesPerSecond_ - used_);
+    used_ += n;
+    return n;
+}
+
+void OutputBatcher::appendTimestamp(int64_t nowMs)
+{
+    char buf[32];
+    const int n = std::snprintf(buf, sizeof(buf), "[%lld.%03d] ",
+                                static_cast<long long>(nowMs / 1000),
+                                static_cast<int>(nowMs % 1000));
+    if (n > 0)
+        pending_.append(buf, static_cast<size_t>(n));
+}
+
+void OutputBatcher::appendDropSummary()
+{
+    stats_.droppedLines += droppedSinceReport_;
+    stats_.droppedBytes += droppedBytesSinceReport_;
+    char buf[128];
+    const int n = std::snprintf(
+        buf, sizeof(buf),
+        "<<<qtmonkey: %lu lines (%lu bytes) of output dropped>>>\n",
+        static_cast<unsigned long>(droppedSinceReport_),
+        static_cast<unsigned long>(droppedBytesSinceReport_));
+    if (n > 0)
+        pending_.append(buf, static_cast<size_t>(n));
+    completeSize_ = pending_.size();
+    droppedSinceReport_ = 0;
+    droppedBytesSinceReport_ = 0;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace qt_monkey_app
+{
+/**
+ * Collect output of user application and pass it by batches,
+ * that end on line boundary where possible, so chatty application
+ * not flood gui with small packets.
+ * If there is byte budget, lines over budget are dropped, line that
+ * exceeds budget is cut, and gui gets summary about dropped lines
+ * instead of them.
+ * Time is passed from outside, in milliseconds of monotonic clock.
+ */
+class OutputBatcher final
+{
+public:
+    /**
+     * Bytes per second that may be passed to gui, one budget
+     * is shared by batchers of stdout and stderr of application
+     */
+    class Budget final
+    {
+    public:
+        //! @param bytesPerSecond 0 - without limit
+        explicit Budget(size_t bytesPerSecond)
+            : bytesPerSecond_(bytesPerSecond)
+        {
+        }
+        Budget(const Budget &) = delete;
+        Budget &operator=(const Budget &) = delete;
+        bool exhausted(int64_t nowMs);
+        //! @return how many of len bytes fit in budget
+        size_t take(int64_t nowMs, size_t len);
+
+    private:
+        const size_t bytesPerSecond_;
+        int64_t startMs_ = 0;
+        size_t used_ = 0;
+
+        void startNewSecond(int64_t nowMs);
+    };
+    struct Options final {
+        //! how long output is collected before sending, 0 - send as soon as
+        //! possible
+        int windowMs = 0;
+        //! send batch without waiting for end of window if it is so big
+        size_t maxBatchSize = 64 * 1024;
+        //! prefix every line with time of its arrival
+        bool timestamps = false;
+        //! how many bytes per second pass to gui, 0 - without limit,
+        //! used to create Budget
+        size_t bytesPerSecond = 0;
+    };
+    struct Stats final {
+        size_t droppedLines = 0;
+        size_t droppedBytes = 0;
+    };
+    using OnBatch = std::function<void(const char *data, size_t len)>;
+
+    //! budget should live longer than batcher
+    OutputBatcher(const Options &opts, Budget &budget)
+        : opts_(opts), budget_(budget)
+    {
+    }
+    void append(const char *data, size_t len, int64_t nowMs);
+    //! there is data, that should be passed right now
+    bool batchReady(int64_t nowMs) const;
+    /**
+     * Pass collected whole lines to callback, and not completed line
+     * if it waits more than window or too big
+     * @param force pass everything collected
+     */
+    void flush(int64_t nowMs, bool force, const OnBatch &onBatch);
+    bool empty() const { return pending_.empty() && droppedSinceReport_ == 0; }
+    const Stats &stats() const { return stats_; }
+    const Options &options() const { return opts_; }
+
+private:
+    const Options opts_;
+    Budget &budget_;
+    Stats stats_;
+    std::string pending_;
+    //! size of whole lines at the beginning of pending_
+    size_t completeSize_ = 0;
+    //! time when the first not sent byte arrived
+    int64_t firstByteMs_ = 0;
+    //! time when not completed line started
+    int64_t partialLineMs_ = 0;
+    bool atLineStart_ = true;
+    bool droppingLine_ = false;
+    size_t droppedSinceReport_ = 0;
+    size_t droppedBytesSinceReport_ = 0;
+
+    void appendTimestamp(int64_t nowMs);
+    void appendDropSummary();
+};
+} // namespace qt_monkey_app
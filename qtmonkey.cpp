@@ -1,9 +1,12 @@
 //#define DEBUG_MOD_QTMONKEY
 #include "qtmonkey.hpp"
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <initializer_list>
 #include <iostream>
+#include <vector>
 
 #ifdef _WIN32 // windows both 32 bit and 64 bit
 #include <windows.h>
@@ -15,6 +18,7 @@
 #include <QtCore/QCoreApplication>
 #include <QtCore/QTextCodec>
 #include <QtCore/QThread>
+#include <QtCore/QTimer>
 
 #include "common.hpp"
 #include "json11.hpp"
@@ -28,8 +32,13 @@
     } while (false)
 #endif
 
+using qt_monkey_agent::Private::Capability;
+using qt_monkey_agent::Private::CommunicationMonkeyPart;
 using qt_monkey_agent::Private::PacketTypeForAgent;
 using qt_monkey_agent::Private::Script;
+using qt_monkey_app::OutputBatcher;
+using qt_monkey_app::PacketWriter;
+using qt_monkey_app::Protocol;
 using qt_monkey_app::QtMonkey;
 using qt_monkey_app::Private::StdinReader;
 using qt_monkey_common::operator<<;
@@ -37,6 +46,8 @@ using qt_monkey_common::operator<<;
 namespace
 {
 static constexpr int waitBeforeExitMs = 300;
+//! write to stdout immediately if there is so many not written data
+static const size_t maxOutBufSize = 64 * 1024;
 
 static inline std::ostream &operator<<(std::ostream &os, const QString &str)
 {
@@ -53,20 +64,40 @@ class ReadStdinThread final : public QThread
 {
 public:
     ReadStdinThread(QObject *parent, StdinReader &reader);
+    ~ReadStdinThread();
     void run() override;
     void stop();
 
 private:
     StdinReader &reader_;
     std::atomic<bool> timeToExit_{false};
+    //! reused for every read, to not allocate memory for each one
+    std::vector<char> buf_;
 #ifdef _WIN32
     HANDLE stdinHandle_;
+#else
+    //! stop() writes to it to wakeup select, so no need in timeout
+    int stopPipe_[2];
 #endif
+
+    void passData(const char *data, size_t len);
 };
 
+static const size_t stdinBufSize = 64 * 1024;
+
+void ReadStdinThread::passData(const char *data, size_t len)
+{
+    {
+        auto ptr = reader_.data.get();
+        ptr->append(data, static_cast<int>(len));
+    }
+    // one notification per read, not per byte
+    reader_.emitDataReady();
+}
+
 #ifdef _WIN32
 ReadStdinThread::ReadStdinThread(QObject *parent, StdinReader &reader)
-    : QThread(parent), reader_(reader)
+    : QThread(parent), reader_(reader), buf_(stdinBufSize)
 {
     stdinHandle_ = ::GetStdHandle(STD_INPUT_HANDLE);
     if (stdinHandle_ == INVALID_HANDLE_VALUE)
@@ -74,10 +105,12 @@ ReadStdinThread::ReadStdinThread(QObject *parent, StdinReader &reader)
                                  + std::to_string(GetLastError()));
 }
 
+ReadStdinThread::~ReadStdinThread() {}
+
 void ReadStdinThread::run()
 {
     while (!timeToExit_) {
-        char ch;
+        DWORD toRead = static_cast<DWORD>(buf_.size());
 
         switch (::GetFileType(stdinHandle_)) {
         case FILE_TYPE_CHAR: { // console
@@ -102,8 +135,9 @@ void ReadStdinThread::run()
             if (numberOfEventsRead != 1 || event.EventType != KEY_EVENT
                 || !event.Event.KeyEvent.bKeyDown)
                 continue;
-            ch = event.Event.KeyEvent.uChar.AsciiChar;
-            break;
+            const char ch = event.Event.KeyEvent.uChar.AsciiChar;
+            passData(&ch, 1);
+            continue;
         }
         case FILE_TYPE_PIPE: {
             DWORD bytesAvailInPipe;
@@ -114,15 +148,21 @@ void ReadStdinThread::run()
                         .arg(::GetLastError()));
                 return;
             }
-            if (bytesAvailInPipe == 0)
+            if (bytesAvailInPipe == 0) {
+                // pipe can not be waited together with stop event
+                ::Sleep(1);
                 continue;
+            }
             if (timeToExit_)
                 return;
+            // do not block, so stop request is handled
+            if (bytesAvailInPipe < toRead)
+                toRead = bytesAvailInPipe;
         }
         // fall through
         default: {
             DWORD readBytes = 0;
-            if (!::ReadFile(stdinHandle_, &ch, sizeof(ch), &readBytes,
+            if (!::ReadFile(stdinHandle_, buf_.data(), toRead, &readBytes,
                             nullptr)) {
                 reader_.emitError(
                     T_("reading from stdin error: %1").arg(::GetLastError()));
@@ -130,79 +170,91 @@ void ReadStdinThread::run()
             }
             if (readBytes == 0)
                 return;
+            passData(buf_.data(), readBytes);
             break;
         }
         } // switch
-
-        {
-            auto ptr = reader_.data.get();
-            ptr->append(ch);
-        }
-        reader_.emitDataReady();
     }
 }
 
 void ReadStdinThread::stop() { timeToExit_ = true; }
 #else
 ReadStdinThread::ReadStdinThread(QObject *parent, StdinReader &reader)
-    : QThread(parent), reader_(reader)
+    : QThread(parent), reader_(reader), buf_(stdinBufSize)
+{
+    if (::pipe(stopPipe_) != 0)
+        throw std::runtime_error("pipe failure: " + std::to_string(errno));
+}
+
+ReadStdinThread::~ReadStdinThread()
 {
+    ::close(stopPipe_[0]);
+    ::close(stopPipe_[1]);
 }
 
 void ReadStdinThread::run()
 {
     while (!timeToExit_) {
-        char ch;
-        fd_set readfds, exceptfds;
+        fd_set readfds;
         FD_ZERO(&readfds);
-        FD_ZERO(&exceptfds);
         FD_SET(STDIN_FILENO, &readfds);
-        FD_SET(STDIN_FILENO, &exceptfds);
-        timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 1000 * 100;
-        const int selRes
-            = select(STDIN_FILENO + 1, &readfds, nullptr, &exceptfds, &timeout);
-        if (selRes == 0) { // timeout
-            continue;
-        } else if (selRes < 0) {
+        FD_SET(stopPipe_[0], &readfds);
+        // no timeout: stop() wakes us via pipe
+        const int selRes = select(std::max(STDIN_FILENO, stopPipe_[0]) + 1,
+                                  &readfds, nullptr, nullptr, nullptr);
+        if (selRes < 0) {
+            if (errno == EINTR)
+                continue;
             reader_.emitError(T_("select stdin return error: %1").arg(errno));
             return;
         }
-        if (FD_ISSET(STDIN_FILENO, &exceptfds)
-            || !FD_ISSET(STDIN_FILENO, &readfds))
+        if (FD_ISSET(stopPipe_[0], &readfds))
+            return;
+        if (!FD_ISSET(STDIN_FILENO, &readfds))
             continue;
 
-        const ssize_t nBytes = ::read(STDIN_FILENO, &ch, sizeof(ch));
+        const ssize_t nBytes = ::read(STDIN_FILENO, buf_.data(), buf_.size());
         if (nBytes < 0) {
+            if (errno == EINTR)
+                continue;
             reader_.emitError(T_("reading from stdin error: %1").arg(errno));
             return;
         } else if (nBytes == 0) {
             break;
         }
-        {
-            auto ptr = reader_.data.get();
-            ptr->append(ch);
-        }
-        reader_.emitDataReady();
+        passData(buf_.data(), static_cast<size_t>(nBytes));
     }
 }
 
 void ReadStdinThread::stop()
 {
     timeToExit_ = true;
+    const char ch = 0;
+    ssize_t res;
     do {
-        if (::close(STDIN_FILENO) == 0)
-            return;
-    } while (errno == EINTR);
-    throw std::runtime_error("close(stdin) failure: " + std::to_string(errno));
+        res = ::write(stopPipe_[1], &ch, sizeof(ch));
+    } while (res < 0 && errno == EINTR);
+    if (res < 0)
+        throw std::runtime_error("write to stop pipe failure: "
+                                 + std::to_string(errno));
 }
 #endif
 } // namespace
 
-QtMonkey::QtMonkey(bool exitOnScriptError)
-    : exitOnScriptError_(exitOnScriptError)
+QtMonkey::QtMonkey(bool exitOnScriptError, Protocol protocol,
+                   const OutputBatcher::Options &outputOpts)
+    : exitOnScriptError_(exitOnScriptError), protocol_(protocol),
+      outputBudget_(outputOpts.bytesPerSecond),
+      stdoutBatcher_(outputOpts, outputBudget_),
+      stderrBatcher_(outputOpts, outputBudget_)
 {
+    outputClock_.start();
+    appOutputTimer_.setSingleShot(true);
+    appOutputTimer_.setInterval(outputOpts.windowMs > 0 ? outputOpts.windowMs
+                                                       : 0);
+    connect(&appOutputTimer_, SIGNAL(timeout()), this,
+            SLOT(onAppOutputTimeout()));
+
     QProcessEnvironment curEnv = QProcessEnvironment::systemEnvironment();
     curEnv.insert(channelWithAgent_.requiredProcessEnvironment().first,
                   channelWithAgent_.requiredProcessEnvironment().second);
@@ -219,15 +271,18 @@ QtMonkey::QtMonkey(bool exitOnScriptError)
 
     connect(&channelWithAgent_, SIGNAL(error(QString)), this,
             SLOT(communicationWithAgentError(const QString &)));
-    connect(&channelWithAgent_, SIGNAL(newUserAppEvent(QString)), this,
-            SLOT(onNewUserAppEvent(QString)));
-    connect(&channelWithAgent_, SIGNAL(scriptError(QString)), this,
-            SLOT(onScriptError(QString)));
+    connect(&channelWithAgent_, SIGNAL(newUserAppEvent(int, QString)), this,
+            SLOT(onNewUserAppEvent(int, QString)));
+    connect(&channelWithAgent_, SIGNAL(scriptError(int, QString)), this,
+            SLOT(onScriptError(int, QString)));
     connect(&channelWithAgent_, SIGNAL(agentReadyToRunScript()), this,
             SLOT(onAgentReadyToRunScript()));
-    connect(&channelWithAgent_, SIGNAL(scriptEnd()), this, SLOT(onScriptEnd()));
-    connect(&channelWithAgent_, SIGNAL(scriptLog(QString)), this,
-            SLOT(onScriptLog(QString)));
+    connect(&channelWithAgent_, SIGNAL(scriptEnd(int)), this,
+            SLOT(onScriptEnd(int)));
+    connect(&channelWithAgent_, SIGNAL(scriptLog(int, QString)), this,
+            SLOT(onScriptLog(int, QString)));
+    connect(&channelWithAgent_, SIGNAL(agentDisconnected(int)), this,
+            SLOT(onAgentDisconnected(int)));
 
     readStdinThread_ = new ReadStdinThread(this, stdinReader_);
     stdinReader_.moveToThread(readStdinThread_);
@@ -252,6 +307,13 @@ QtMonkey::~QtMonkey()
     }
     // so any signals from channel will be disconected
     channelWithAgent_.close();
+    flushAppOutput(true);
+    flushOutput();
+    const size_t droppedLines = stdoutBatcher_.stats().droppedLines
+                                + stderrBatcher_.stats().droppedLines;
+    if (droppedLines > 0)
+        qWarning("%s: %lu lines of user app output were dropped", Q_FUNC_INFO,
+                 static_cast<unsigned long>(droppedLines));
 }
 
 void QtMonkey::communicationWithAgentError(const QString &errStr)
@@ -259,15 +321,29 @@ void QtMonkey::communicationWithAgentError(const QString &errStr)
     qWarning("%s: errStr %s", Q_FUNC_INFO, qPrintable(errStr));
 }
 
-void QtMonkey::onNewUserAppEvent(QString scriptLines)
+void QtMonkey::onNewUserAppEvent(int sessionId, QString scriptLines)
 {
-    std::cout << qt_monkey_app::createPacketFromUserAppEvent(scriptLines)
-              << std::endl;
+    // main process is not named, so scripts for single process
+    // look the same as before
+    const QString processName
+        = sessionId == channelWithAgent_.findSession(QString())
+              ? QString()
+              : channelWithAgent_.sessionName(sessionId);
+    if (processName != lastEventProcess_) {
+        // so recorded script can be replayed
+        scriptLines = QStringLiteral("<<<IN PROCESS %1>>>\n").arg(processName)
+                      + scriptLines;
+        lastEventProcess_ = processName;
+    }
+    PacketWriter{outBuf_, protocol_}.userAppEvent(scriptLines, processName);
+    packetToGuiReady(outBuf_, false);
 }
 
 void QtMonkey::userAppError(QProcess::ProcessError err)
 {
     qDebug("%s: begin err %d", Q_FUNC_INFO, static_cast<int>(err));
+    flushAppOutput(true);
+    flushOutput();
     throw std::runtime_error(
         qPrintable(qt_monkey_common::processErrorToString(err)));
 }
@@ -277,13 +353,14 @@ void QtMonkey::userAppFinished(int exitCode, QProcess::ExitStatus exitStatus)
     qDebug("%s: begin exitCode %d, exitStatus %d", Q_FUNC_INFO, exitCode,
            static_cast<int>(exitStatus));
     qt_monkey_common::processEventsFor(waitBeforeExitMs);
+    flushAppOutput(true);
     if (exitCode != EXIT_SUCCESS)
         throw std::runtime_error(T_("user app exit status not %1: %2")
                                      .arg(EXIT_SUCCESS)
                                      .arg(exitCode)
                                      .toUtf8()
                                      .data());
-    setScriptRunningState(false);
+    scriptsInFlight_ = 0;
     if (toRunList_.empty()) {
         QCoreApplication::exit(EXIT_SUCCESS);
     } else {
@@ -295,46 +372,93 @@ void QtMonkey::userAppFinished(int exitCode, QProcess::ExitStatus exitStatus)
 
 void QtMonkey::userAppNewOutput()
 {
-    const QString stdoutStr
-        = QString::fromLocal8Bit(userApp_.readAllStandardOutput());
-    std::cout << createPacketFromUserAppOutput(stdoutStr) << std::endl;
+    const QByteArray data = userApp_.readAllStandardOutput();
+    stdoutBatcher_.append(data.constData(), static_cast<size_t>(data.size()),
+                          outputClock_.elapsed());
+    appOutputReady();
 }
 
 void QtMonkey::userAppNewErrOutput()
 {
-    const QString errOut
-        = QString::fromLocal8Bit(userApp_.readAllStandardError());
-    std::cout << createPacketFromUserAppErrors(errOut) << std::endl;
+    const QByteArray data = userApp_.readAllStandardError();
+    stderrBatcher_.append(data.constData(), static_cast<size_t>(data.size()),
+                          outputClock_.elapsed());
+    appOutputReady();
 }
 
-void QtMonkey::stdinDataReady()
+void QtMonkey::appOutputReady()
 {
-    auto dataPtr = stdinReader_.data.get();
-    size_t parserStopPos;
-    parseOutputFromGui(
-        {dataPtr->constData(), static_cast<size_t>(dataPtr->size())},
-        parserStopPos,
-        [this](QString script_code, QString scriptFileName) {
-            auto scripts
-                = Script::splitToExecutableParts(scriptFileName, script_code);
-            for (auto &&script : scripts) {
-                toRunList_.push(std::move(script));
-            }
-            onAgentReadyToRunScript();
-        },
-        [](QString errMsg) {
-            std::cerr
-                << T_("Can not parse gui<->monkey protocol: %1\n").arg(errMsg);
+    flushAppOutput(false);
+    if ((!stdoutBatcher_.empty() || !stderrBatcher_.empty())
+        && !appOutputTimer_.isActive())
+        appOutputTimer_.start();
+}
+
+void QtMonkey::onAppOutputTimeout() { appOutputReady(); }
+
+void QtMonkey::flushAppOutput(bool force)
+{
+    const qint64 now = outputClock_.elapsed();
+    if (force || stdoutBatcher_.batchReady(now))
+        stdoutBatcher_.flush(now, force, [this](const char *data, size_t len) {
+            PacketWriter{appOutBuf_, protocol_}.userAppOutput(
+                QString::fromLocal8Bit(data, static_cast<int>(len)));
+            packetToGuiReady(appOutBuf_, false);
+        });
+    if (force || stderrBatcher_.batchReady(now))
+        stderrBatcher_.flush(now, force, [this](const char *data, size_t len) {
+            PacketWriter{appOutBuf_, protocol_}.userAppErrors(
+                QString::fromLocal8Bit(data, static_cast<int>(len)));
+            packetToGuiReady(appOutBuf_, false);
         });
-    if (parserStopPos != 0)
-        dataPtr->remove(0, parserStopPos);
 }
 
-void QtMonkey::onScriptError(QString errMsg)
+void QtMonkey::stdinDataReady()
+{
+    QByteArray data;
+    {
+        // take all data, so reader thread not wait for parsing
+        auto dataPtr = stdinReader_.data.get();
+        data.swap(*dataPtr);
+    }
+    if (data.isEmpty())
+        return;
+    auto onRunScript = [this](QString script_code, QString scriptFileName) {
+        auto scripts
+            = Script::splitToExecutableParts(scriptFileName, script_code);
+        for (auto &&script : scripts) {
+            toRunList_.push(std::move(script));
+        }
+        onAgentReadyToRunScript();
+    };
+    auto onParseError = [](QString errMsg) {
+        std::cerr << T_("Can not parse gui<->monkey protocol: %1\n")
+                         .arg(errMsg);
+    };
+    if (protocol_ == Protocol::Binary) {
+        if (!stdinBinaryFramer_.feed(
+                data.constData(), static_cast<size_t>(data.size()),
+                [&](qt_monkey_app::MessageType type, const char *payload,
+                    size_t len) {
+                    parseBinaryFrameFromGui(type, payload, len, onRunScript,
+                                            onParseError);
+                }))
+            onParseError(T_("damaged binary frame"));
+        return;
+    }
+    stdinFramer_.feed(data.constData(), static_cast<size_t>(data.size()),
+                      [&](const char *msg, size_t len) {
+                          parseLineFromGui(msg, len, onRunScript,
+                                           onParseError);
+                      });
+}
+
+void QtMonkey::onScriptError(int /*sessionId*/, QString errMsg)
 {
     qDebug("%s: begin %s", Q_FUNC_INFO, qPrintable(errMsg));
-    setScriptRunningState(false);
-    std::cout << createPacketFromUserAppErrors(errMsg) << std::endl;
+    // agent reports ScriptEnd after error, so script still in flight
+    PacketWriter{outBuf_, protocol_}.scriptError(errMsg);
+    packetToGuiReady(outBuf_, true);
     if (exitOnScriptError_) {
         qt_monkey_common::processEventsFor(waitBeforeExitMs);
         throw std::runtime_error(
@@ -365,10 +489,13 @@ bool QtMonkey::runScriptFromFile(QString codeToRunBeforeAll,
                          qPrintable(codeToRunBeforeAll), qPrintable(fn));
                 Script prefs_script{QStringLiteral("<tmp>"), 1,
                                     codeToRunBeforeAll};
-                prefs_script.setRunAfterAppStart(!toRunList_.empty());
+                prefs_script.setProcessName(script.processName());
+                prefs_script.setRunAfterAppStart(
+                    !toRunList_.empty() && !script.continuesPreviousPart());
                 toRunList_.push(std::move(prefs_script));
             } else {
-                script.setRunAfterAppStart(!toRunList_.empty());
+                script.setRunAfterAppStart(!toRunList_.empty()
+                                           && !script.continuesPreviousPart());
             }
             toRunList_.push(std::move(script));
         }
@@ -379,49 +506,106 @@ bool QtMonkey::runScriptFromFile(QString codeToRunBeforeAll,
 
 void QtMonkey::onAgentReadyToRunScript()
 {
-    DBGPRINT("%s: begin is connected %s, run list empty %s, script running %s",
-             Q_FUNC_INFO,
-             channelWithAgent_.isConnectedState() ? "true" : "false",
-             toRunList_.empty() ? "true" : "false",
-             scriptRunning_ ? "true" : "false");
-    if (!channelWithAgent_.isConnectedState() || toRunList_.empty()
-        || scriptRunning_)
-        return;
-
-    if (toRunList_.front().runAfterAppStart()) {
-        if (restartDone_) {
-            restartDone_ = false;
-        } else {
-            DBGPRINT("%s: restartDone false, exiting", Q_FUNC_INFO);
+    DBGPRINT("%s: begin run list empty %s, scripts in flight %d", Q_FUNC_INFO,
+             toRunList_.empty() ? "true" : "false", scriptsInFlight_);
+    while (!toRunList_.empty()) {
+        const int sessionId
+            = channelWithAgent_.findSession(toRunList_.front().processName());
+        if (sessionId == CommunicationMonkeyPart::invalidSession) {
+            DBGPRINT("%s: wait for agent of '%s'", Q_FUNC_INFO,
+                     qPrintable(toRunList_.front().processName()));
+            return;
+        }
+        // if agent can queue scripts, send all scripts for it that not
+        // require restart of application at once, so agent run them without
+        // round trip to us between them
+        const bool canQueue = channelWithAgent_.agentHasCapability(
+            sessionId, Capability::ScriptQueue);
+        if (scriptsInFlight_ > 0
+            && (!canQueue || sessionId != inFlightSession_))
             return;
+
+        if (toRunList_.front().runAfterAppStart()) {
+            if (restartDone_ && scriptsInFlight_ == 0) {
+                restartDone_ = false;
+            } else {
+                DBGPRINT("%s: restartDone false, exiting", Q_FUNC_INFO);
+                return;
+            }
         }
+
+        Script script = std::move(toRunList_.front());
+        toRunList_.pop();
+        QString code;
+        script.releaseCode(code);
+        const bool moreScriptsQueued
+            = canQueue && !toRunList_.empty()
+              && !toRunList_.front().runAfterAppStart()
+              && channelWithAgent_.findSession(
+                     toRunList_.front().processName())
+                     == sessionId;
+        channelWithAgent_.sendCommand(
+            sessionId, PacketTypeForAgent::SetScriptFileName,
+            script.fileName());
+        channelWithAgent_.sendCommand(sessionId,
+                                      moreScriptsQueued
+                                          ? PacketTypeForAgent::RunQueuedScript
+                                          : PacketTypeForAgent::RunScript,
+                                      std::move(code));
+        ++scriptsInFlight_;
+        inFlightSession_ = sessionId;
     }
+}
 
-    Script script = std::move(toRunList_.front());
-    toRunList_.pop();
-    QString code;
-    script.releaseCode(code);
-    channelWithAgent_.sendCommand(PacketTypeForAgent::SetScriptFileName,
-                                  script.fileName());
-    channelWithAgent_.sendCommand(PacketTypeForAgent::RunScript,
-                                  std::move(code));
-    setScriptRunningState(true);
+void QtMonkey::onScriptEnd(int sessionId)
+{
+    if (sessionId == inFlightSession_ && scriptsInFlight_ > 0)
+        --scriptsInFlight_;
+    PacketWriter{outBuf_, protocol_}.scriptEnd();
+    packetToGuiReady(outBuf_, true);
+    onAgentReadyToRunScript();
 }
 
-void QtMonkey::onScriptEnd()
+void QtMonkey::onAgentDisconnected(int sessionId)
 {
-    setScriptRunningState(false);
-    std::cout << createPacketFromScriptEnd() << std::endl;
+    DBGPRINT("%s: session %d", Q_FUNC_INFO, sessionId);
+    // process exited, so it will not report about end of scripts
+    if (sessionId == inFlightSession_)
+        scriptsInFlight_ = 0;
+    // next script may be for other process
+    onAgentReadyToRunScript();
 }
 
-void QtMonkey::onScriptLog(QString msg)
+void QtMonkey::onScriptLog(int /*sessionId*/, QString msg)
 {
-    std::cout << createPacketFromUserAppScriptLog(msg) << std::endl;
+    PacketWriter{outBuf_, protocol_}.scriptLog(msg);
+    packetToGuiReady(outBuf_, false);
 }
 
-void QtMonkey::setScriptRunningState(bool val)
+void QtMonkey::packetToGuiReady(std::string &buf, bool flushNow)
 {
-    scriptRunning_ = val;
-    if (!scriptRunning_)
-        onAgentReadyToRunScript();
+    if (protocol_ == Protocol::Json)
+        buf += '\n';
+    if (flushNow || outBuf_.size() + appOutBuf_.size() >= maxOutBufSize) {
+        flushOutput();
+    } else if (!flushScheduled_) {
+        // packets generated while handling of current events
+        // are written together
+        flushScheduled_ = true;
+        QTimer::singleShot(0, this, SLOT(flushOutput()));
+    }
+}
+
+void QtMonkey::flushOutput()
+{
+    flushScheduled_ = false;
+    if (outBuf_.empty() && appOutBuf_.empty())
+        return;
+    // events and script results first, output of app can wait
+    for (std::string *buf : {&outBuf_, &appOutBuf_}) {
+        std::cout.write(buf->data(), static_cast<std::streamsize>(buf->size()));
+        // keep capacity, so buffer is reused
+        buf->clear();
+    }
+    std::cout.flush();
 }
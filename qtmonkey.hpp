@@ -1,12 +1,17 @@
 #pragma once
 
 #include <queue>
+#include <string>
 
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QFile>
 #include <QtCore/QObject>
 #include <QtCore/QProcess>
+#include <QtCore/QTimer>
 
 #include "agent_qtmonkey_communication.hpp"
+#include "output_batcher.hpp"
+#include "qtmonkey_app_api.hpp"
 #include "script.hpp"
 #include "shared_resource.hpp"
 
@@ -42,7 +47,9 @@ class QtMonkey
 {
     Q_OBJECT
 public:
-    explicit QtMonkey(bool exitOnScriptError);
+    explicit QtMonkey(
+        bool exitOnScriptError, Protocol protocol = Protocol::Json,
+        const OutputBatcher::Options &outputOpts = OutputBatcher::Options());
     ~QtMonkey();
     void runApp(QString userAppPath, QStringList userAppArgs)
     {
@@ -59,26 +66,58 @@ private slots:
     void userAppNewOutput();
     void userAppNewErrOutput();
     void communicationWithAgentError(const QString &errStr);
-    void onNewUserAppEvent(QString scriptLines);
+    void onNewUserAppEvent(int sessionId, QString scriptLines);
     void stdinDataReady();
-    void onScriptError(QString errMsg);
+    void onScriptError(int sessionId, QString errMsg);
     void onAgentReadyToRunScript();
-    void onScriptEnd();
-    void onScriptLog(QString msg);
+    void onScriptEnd(int sessionId);
+    void onScriptLog(int sessionId, QString msg);
+    void onAgentDisconnected(int sessionId);
+    void flushOutput();
+    void onAppOutputTimeout();
 
 private:
-    bool scriptRunning_ = false;
+    //! sent to agent, but not ended scripts
+    int scriptsInFlight_ = 0;
+    //! all scripts in flight are sent to the same agent
+    int inFlightSession_ = -1;
+    //! process of last recorded event, empty for main process
+    QString lastEventProcess_;
 
     qt_monkey_agent::Private::CommunicationMonkeyPart channelWithAgent_;
     QProcess userApp_;
     std::queue<qt_monkey_agent::Private::Script> toRunList_;
     bool exitOnScriptError_ = false;
+    //! encoding of packets from/to gui
+    Protocol protocol_ = Protocol::Json;
     Private::StdinReader stdinReader_;
+    JsonLineFramer stdinFramer_;
+    BinaryFramer stdinBinaryFramer_;
+    //! packets for gui, not written to stdout yet
+    std::string outBuf_;
+    //! packets with output of user app, written after outBuf_,
+    //! so it not delays recorded events and script results
+    std::string appOutBuf_;
+    //! shared by stdout and stderr, so limit is for whole output
+    OutputBatcher::Budget outputBudget_;
+    OutputBatcher stdoutBatcher_;
+    OutputBatcher stderrBatcher_;
+    QTimer appOutputTimer_;
+    QElapsedTimer outputClock_;
+    bool flushScheduled_ = false;
     QThread *readStdinThread_ = nullptr;
     QString userAppPath_;
     QStringList userAppArgs_;
     bool restartDone_ = false;
 
-    void setScriptRunningState(bool val);
+    /**
+     * Packet appended to buf, write it to stdout now or
+     * after handling of current events
+     * @param flushNow true for packets that gui waits for
+     */
+    void packetToGuiReady(std::string &buf, bool flushNow);
+    void appOutputReady();
+    //! @param force send also not completed lines
+    void flushAppOutput(bool force);
 };
 } // namespace qt_monkey_app
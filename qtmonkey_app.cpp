@@ -3,12 +3,18 @@
 #include <cstring>
 #include <iostream>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 #include <QtCore/QCoreApplication>
 #include <QtCore/QProcess>
 #include <QtCore/QTextStream>
 
 #include "common.hpp"
 #include "qtmonkey.hpp"
+#include "suite_runner.hpp"
 
 using qt_monkey_common::operator<<;
 
@@ -77,6 +83,12 @@ static QString usage()
               "[--trace-script-exec] "
               "[--save-screenshots path/to/dir maxium_number] "
               "[--script path/to/script] "
+              "[--protocol=json|binary] "
+              "[--output-window ms] [--output-budget bytes_per_second] "
+              "[--output-timestamps] "
+              "[--jobs N [--worker-display=xvfb|offscreen|inherit] "
+              "[--durations path/to/durations.json] "
+              "[--report path/to/report.json]] "
               "--user-app "
               "path/to/application [application's command line args]\n")
         .arg(QCoreApplication::applicationFilePath());
@@ -93,6 +105,17 @@ int main(int argc, char *argv[])
     QStringList scripts;
     const char *encoding = "UTF-8";
     QString codeToRunBeforeAll;
+    qt_monkey_app::Protocol protocol = qt_monkey_app::Protocol::Json;
+    static const char protocolOpt[] = "--protocol=";
+    qt_monkey_app::OutputBatcher::Options outputOpts;
+    qt_monkey_app::SuiteRunner::Options suiteOpts;
+    bool suiteMode = false;
+    static const char workerDisplayOpt[] = "--worker-display=";
+    // options that workers of suite should get
+    auto forwardToWorkers = [&suiteOpts, argv](int from, int to) {
+        for (int k = from; k <= to; ++k)
+            suiteOpts.monkeyArgs << QString::fromLocal8Bit(argv[k]);
+    };
 
     for (int i = 1; i < argc; ++i)
         if (std::strcmp(argv[i], "--user-app") == 0) {
@@ -117,9 +140,11 @@ int main(int argc, char *argv[])
                 std::cerr << qPrintable(usage());
                 return EXIT_FAILURE;
             }
+            forwardToWorkers(i, i + 1);
             ++i;
             encoding = argv[i];
         } else if (std::strcmp(argv[i], "--trace-script-exec") == 0) {
+            forwardToWorkers(i, i);
             codeToRunBeforeAll
                 += QStringLiteral("Test.setTraceEnabled(true);\n");
         } else if (std::strcmp(argv[i], "--save-screenshots") == 0) {
@@ -128,12 +153,84 @@ int main(int argc, char *argv[])
                 std::cerr << qPrintable(usage());
                 return EXIT_FAILURE;
             }
+            forwardToWorkers(i, i + 2);
             const QString path = argv[i + 1];
             i += 2;
             codeToRunBeforeAll
                 += QStringLiteral("Test.saveScreenshots(\"%1\", %2);\n")
                        .arg(path)
                        .arg(nSteps);
+        } else if (std::strcmp(argv[i], "--output-window") == 0) {
+            if ((i + 1) >= argc
+                || sscanf(argv[i + 1], "%d", &outputOpts.windowMs) != 1
+                || outputOpts.windowMs < 0) {
+                std::cerr << qPrintable(usage());
+                return EXIT_FAILURE;
+            }
+            forwardToWorkers(i, i + 1);
+            ++i;
+        } else if (std::strcmp(argv[i], "--output-budget") == 0) {
+            unsigned long budget = 0;
+            if ((i + 1) >= argc || sscanf(argv[i + 1], "%lu", &budget) != 1) {
+                std::cerr << qPrintable(usage());
+                return EXIT_FAILURE;
+            }
+            forwardToWorkers(i, i + 1);
+            ++i;
+            outputOpts.bytesPerSecond = budget;
+        } else if (std::strcmp(argv[i], "--output-timestamps") == 0) {
+            forwardToWorkers(i, i);
+            outputOpts.timestamps = true;
+        } else if (std::strcmp(argv[i], "--jobs") == 0) {
+            if ((i + 1) >= argc
+                || sscanf(argv[i + 1], "%d", &suiteOpts.jobs) != 1
+                || suiteOpts.jobs < 1) {
+                std::cerr << qPrintable(usage());
+                return EXIT_FAILURE;
+            }
+            ++i;
+            suiteMode = true;
+        } else if (std::strncmp(argv[i], workerDisplayOpt,
+                                sizeof(workerDisplayOpt) - 1)
+                   == 0) {
+            const char *name = argv[i] + sizeof(workerDisplayOpt) - 1;
+            if (std::strcmp(name, "xvfb") == 0) {
+                suiteOpts.display = qt_monkey_app::SuiteRunner::Display::Xvfb;
+            } else if (std::strcmp(name, "offscreen") == 0) {
+                suiteOpts.display
+                    = qt_monkey_app::SuiteRunner::Display::Offscreen;
+            } else if (std::strcmp(name, "inherit") == 0) {
+                suiteOpts.display
+                    = qt_monkey_app::SuiteRunner::Display::Inherit;
+            } else {
+                std::cerr << qPrintable(usage());
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--durations") == 0) {
+            if ((i + 1) >= argc) {
+                std::cerr << qPrintable(usage());
+                return EXIT_FAILURE;
+            }
+            ++i;
+            suiteOpts.historyPath = QFile::decodeName(argv[i]);
+        } else if (std::strcmp(argv[i], "--report") == 0) {
+            if ((i + 1) >= argc) {
+                std::cerr << qPrintable(usage());
+                return EXIT_FAILURE;
+            }
+            ++i;
+            suiteOpts.reportPath = QFile::decodeName(argv[i]);
+        } else if (std::strncmp(argv[i], protocolOpt, sizeof(protocolOpt) - 1)
+                   == 0) {
+            const char *name = argv[i] + sizeof(protocolOpt) - 1;
+            if (std::strcmp(name, "json") == 0) {
+                protocol = qt_monkey_app::Protocol::Json;
+            } else if (std::strcmp(name, "binary") == 0) {
+                protocol = qt_monkey_app::Protocol::Binary;
+            } else {
+                std::cerr << qPrintable(usage());
+                return EXIT_FAILURE;
+            }
         } else if (std::strcmp(argv[i], "--help") == 0
                    || std::strcmp(argv[i], "-h") == 0) {
             std::cout << qPrintable(usage());
@@ -151,7 +248,27 @@ int main(int argc, char *argv[])
     QStringList userAppArgs;
     for (int i = userAppOffset + 1; i < argc; ++i)
         userAppArgs << QString::fromLocal8Bit(argv[i]);
-    qt_monkey_app::QtMonkey monkey(exitOnScriptError);
+    if (suiteMode) {
+        if (scripts.empty()) {
+            std::cerr << qPrintable(
+                T_("You should set scripts of suite with --script\n"));
+            return EXIT_FAILURE;
+        }
+        suiteOpts.userAppPath = QString::fromLocal8Bit(argv[userAppOffset]);
+        suiteOpts.userAppArgs = std::move(userAppArgs);
+        qt_monkey_app::SuiteRunner runner(std::move(suiteOpts));
+        if (!runner.start(scripts))
+            return EXIT_FAILURE;
+        return app.exec();
+    }
+#ifdef _WIN32
+    if (protocol == qt_monkey_app::Protocol::Binary) {
+        // frames may contain '\n' bytes, so disable CRLF conversion
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+    }
+#endif
+    qt_monkey_app::QtMonkey monkey(exitOnScriptError, protocol, outputOpts);
 
     if (!scripts.empty()
         && !monkey.runScriptFromFile(std::move(codeToRunBeforeAll),
@@ -1,6 +1,9 @@
 #include "qtmonkey_app_api.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <utility>
 
 #include "common.hpp"
 #include "json11.hpp"
@@ -12,61 +15,340 @@ using json11::Json;
 
 namespace
 {
-struct QStringJsonTrait final {
-    explicit QStringJsonTrait(const QString &s) : str_(s) {}
-    std::string to_json() const { return str_.toUtf8().data(); }
+//! frame: type and payload length, both uint32 little endian
+static const size_t binaryHeaderSize = 8;
+//! protection against damaged stream
+static const uint32_t maxBinaryPayload = 256u * 1024u * 1024u;
+//! how much of not parsed line is shown in error message
+static const size_t maxShownBadChars = 80;
 
-private:
-    const QString &str_;
+static void checkWholeLineParsed(const char *line, size_t len,
+                                 size_t stopPos,
+                                 const std::function<void(QString)> &onError)
+{
+    if (stopPos >= len)
+        return;
+    const size_t shown = std::min(len - stopPos, maxShownBadChars);
+    onError(QStringLiteral("not json: %1")
+                .arg(QString::fromUtf8(line + stopPos,
+                                       static_cast<int>(shown))));
+}
+
+/**
+ * Description of message, common for json and binary encodings.
+ * In json message without fields is string with name, otherwise it is
+ * object with name as the only key. Value of key is string if message has
+ * one field without name, and object with named fields otherwise.
+ * In binary encoding fields go in the same order.
+ */
+struct MessageDef final {
+    MessageType type;
+    const char *name;
+    size_t nFields;
+    //! not required fields are not written to json if they are empty
+    size_t nRequired;
+    const char *fieldNames[2];
 };
+
+static const MessageDef messageDefs[] = {
+    {MessageType::UserAppEvent, "event", 2, 1, {"script", "process"}},
+    {MessageType::UserAppOutput, "app output", 1, 1, {nullptr, nullptr}},
+    {MessageType::UserAppErrors, "app errors", 1, 1, {nullptr, nullptr}},
+    {MessageType::ScriptEnd, "script end", 0, 0, {nullptr, nullptr}},
+    {MessageType::ScriptLog, "script logs", 1, 1, {nullptr, nullptr}},
+    {MessageType::RunScript, "run script", 2, 2, {"script", "file"}},
+    {MessageType::ScriptError, "script error", 1, 1, {nullptr, nullptr}},
+};
+
+static const MessageDef *findMessageDef(MessageType type)
+{
+    for (const MessageDef &def : messageDefs)
+        if (def.type == type)
+            return &def;
+    return nullptr;
+}
+
+static void appendUInt32(std::string &out, uint32_t val)
+{
+    for (int i = 0; i < 4; ++i)
+        out += static_cast<char>((val >> (8 * i)) & 0xFF);
+}
+
+static void setUInt32(std::string &out, size_t pos, uint32_t val)
+{
+    for (int i = 0; i < 4; ++i)
+        out[pos + i] = static_cast<char>((val >> (8 * i)) & 0xFF);
+}
+
+static uint32_t readUInt32(const char *p)
+{
+    const auto u = reinterpret_cast<const unsigned char *>(p);
+    return static_cast<uint32_t>(u[0]) | (static_cast<uint32_t>(u[1]) << 8)
+           | (static_cast<uint32_t>(u[2]) << 16)
+           | (static_cast<uint32_t>(u[3]) << 24);
+}
+
+/**
+ * Append str, UTF-16 converted to UTF-8 on the fly.
+ * If json is true, str is quoted and escaped as json string.
+ */
+template <bool json>
+static void appendUtf8(std::string &out, const QString &str)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    auto appendEscaped = [&out](uint c) {
+        out += "\\u";
+        for (int shift = 12; shift >= 0; shift -= 4)
+            out += hexDigits[(c >> shift) & 0xF];
+    };
+    out.reserve(out.size() + static_cast<size_t>(str.size()) + 2);
+    if (json)
+        out += '"';
+    const QChar *p = str.constData();
+    const QChar *const end = p + str.size();
+    for (; p != end; ++p) {
+        uint c = p->unicode();
+        if (c < 0x80) {
+            if (!json) {
+                out += static_cast<char>(c);
+                continue;
+            }
+            switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\b':
+                out += "\\b";
+                break;
+            case '\f':
+                out += "\\f";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (c < 0x20)
+                    appendEscaped(c);
+                else
+                    out += static_cast<char>(c);
+                break;
+            }
+            continue;
+        }
+        if (p->isHighSurrogate() && p + 1 != end && (p + 1)->isLowSurrogate()) {
+            c = QChar::surrogateToUcs4(p->unicode(), (p + 1)->unicode());
+            ++p;
+        } else if (c >= 0xD800 && c <= 0xDFFF) {
+            c = 0xFFFD; // not paired surrogate
+        }
+        if (json && (c == 0x2028 || c == 0x2029)) {
+            // valid json, but not valid javascript
+            appendEscaped(c);
+        } else if (c < 0x800) {
+            out += static_cast<char>(0xC0 | (c >> 6));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            out += static_cast<char>(0xE0 | (c >> 12));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (c >> 18));
+            out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        }
+    }
+    if (json)
+        out += '"';
+}
+
+/**
+ * Split payload of binary frame to fields, each of them is
+ * uint32 length plus UTF-8 data
+ * @return number of fields or -1 if payload is damaged
+ */
+static int splitToFields(const char *payload, size_t len, QString *fields,
+                         size_t maxFields)
+{
+    size_t n = 0;
+    const char *const end = payload + len;
+    while (payload != end) {
+        if (n == maxFields || static_cast<size_t>(end - payload) < 4)
+            return -1;
+        const uint32_t fieldLen = readUInt32(payload);
+        payload += 4;
+        if (static_cast<size_t>(end - payload) < fieldLen)
+            return -1;
+        fields[n++] = QString::fromUtf8(payload, static_cast<int>(fieldLen));
+        payload += fieldLen;
+    }
+    return static_cast<int>(n);
+}
+
+//! @return false if payload not match description of message
+static bool parseBinaryFields(MessageType type, const char *payload,
+                              size_t len, QString (&fields)[2])
+{
+    const MessageDef *def = findMessageDef(type);
+    assert(def != nullptr);
+    const int n = splitToFields(payload, len, fields, def->nFields);
+    return n >= static_cast<int>(def->nRequired);
+}
 } // namespace
 
-std::string createPacketFromUserAppEvent(const QString &scriptLines)
+void PacketWriter::write(MessageType type,
+                         std::initializer_list<const QString *> fields)
+{
+    const MessageDef *def = findMessageDef(type);
+    assert(def != nullptr && fields.size() == def->nFields);
+    if (protocol_ == Protocol::Binary) {
+        const size_t frameStart = out_.size();
+        appendUInt32(out_, static_cast<uint32_t>(type));
+        // lengths are known only after conversion to UTF-8
+        appendUInt32(out_, 0);
+        for (const QString *field : fields) {
+            const size_t fieldStart = out_.size();
+            appendUInt32(out_, 0);
+            appendUtf8<false>(out_, *field);
+            setUInt32(out_, fieldStart,
+                      static_cast<uint32_t>(out_.size() - fieldStart - 4));
+        }
+        setUInt32(out_, frameStart + 4,
+                  static_cast<uint32_t>(out_.size() - frameStart
+                                        - binaryHeaderSize));
+        return;
+    }
+    if (def->nFields == 0) {
+        out_ += '"';
+        out_ += def->name;
+        out_ += '"';
+        return;
+    }
+    out_ += "{\"";
+    out_ += def->name;
+    out_ += "\":";
+    if (def->fieldNames[0] == nullptr) {
+        appendUtf8<true>(out_, **fields.begin());
+    } else {
+        out_ += '{';
+        size_t i = 0;
+        for (const QString *field : fields) {
+            if (i >= def->nRequired && field->isEmpty()) {
+                ++i;
+                continue;
+            }
+            if (i > 0)
+                out_ += ',';
+            out_ += '"';
+            out_ += def->fieldNames[i];
+            out_ += "\":";
+            appendUtf8<true>(out_, *field);
+            ++i;
+        }
+        out_ += '}';
+    }
+    out_ += '}';
+}
+
+void PacketWriter::userAppEvent(const QString &scriptLines,
+                                const QString &processName)
+{
+    write(MessageType::UserAppEvent, {&scriptLines, &processName});
+}
+
+void PacketWriter::userAppOutput(const QString &stdOutLines)
+{
+    write(MessageType::UserAppOutput, {&stdOutLines});
+}
+
+void PacketWriter::userAppErrors(const QString &errMsg)
 {
-    auto json = Json::object{
-        {"event", Json::object{{"script", QStringJsonTrait{scriptLines}}}}};
+    write(MessageType::UserAppErrors, {&errMsg});
+}
 
-    return Json{json}.dump();
+void PacketWriter::scriptError(const QString &errMsg)
+{
+    write(MessageType::ScriptError, {&errMsg});
+}
+
+void PacketWriter::scriptEnd() { write(MessageType::ScriptEnd, {}); }
+
+void PacketWriter::scriptLog(const QString &logMsg)
+{
+    write(MessageType::ScriptLog, {&logMsg});
+}
+
+void PacketWriter::runScript(const QString &script,
+                             const QString &scriptFileName)
+{
+    write(MessageType::RunScript, {&script, &scriptFileName});
+}
+
+std::string createPacketFromUserAppEvent(const QString &scriptLines,
+                                        const QString &processName)
+{
+    std::string res;
+    PacketWriter{res}.userAppEvent(scriptLines, processName);
+    return res;
 }
 
 std::string createPacketFromUserAppOutput(const QString &stdOutLines)
 {
-    auto json = Json::object{{"app output", QStringJsonTrait{stdOutLines}}};
-    return Json{json}.dump();
+    std::string res;
+    PacketWriter{res}.userAppOutput(stdOutLines);
+    return res;
 }
 
 std::string createPacketFromUserAppErrors(const QString &errMsg)
 {
-    auto json = Json::object{{"app errors", QStringJsonTrait{errMsg}}};
-    return Json{json}.dump();
+    std::string res;
+    PacketWriter{res}.userAppErrors(errMsg);
+    return res;
+}
+
+std::string createPacketFromScriptError(const QString &errMsg)
+{
+    std::string res;
+    PacketWriter{res}.scriptError(errMsg);
+    return res;
 }
 
 std::string createPacketFromScriptEnd()
 {
-    auto json = Json{"script end"};
-    return Json{json}.dump();
+    std::string res;
+    PacketWriter{res}.scriptEnd();
+    return res;
 }
 
 std::string createPacketFromUserAppScriptLog(const QString &logMsg)
 {
-    auto json = Json::object{{"script logs", QStringJsonTrait{logMsg}}};
-    return Json{json}.dump();
+    std::string res;
+    PacketWriter{res}.scriptLog(logMsg);
+    return res;
 }
 
 std::string createPacketFromRunScript(const QString &script,
                                       const QString &scriptFileName)
 {
-    auto json = Json::object{
-        {"run script",
-         Json::object{{"script", QStringJsonTrait{script}},
-                      {"file", QStringJsonTrait{scriptFileName}}}}};
-    return Json{json}.dump();
+    std::string res;
+    PacketWriter{res}.runScript(script, scriptFileName);
+    return res;
 }
 
 void parseOutputFromMonkeyApp(
     const json11::string_view &data, size_t &stopPos,
     const std::function<void(QString)> &onNewUserAppEvent,
     const std::function<void(QString)> &onUserAppError,
+    const std::function<void(QString)> &onScriptError,
     const std::function<void()> &onScriptEnd,
     const std::function<void(QString)> &onScriptLog,
     const std::function<void(QString)> &onParseError)
@@ -83,16 +365,15 @@ void parseOutputFromMonkeyApp(
         if (elm.is_object() && elm.object_items().size() == 1u
             && elm.object_items().begin()->first == "event") {
             const Json &eventJson = elm.object_items().begin()->second;
-            if (!eventJson.is_object() || eventJson.object_items().size() != 1u
-                || eventJson.object_items().begin()->first != "script"
-                || !eventJson.object_items().begin()->second.is_string()) {
+            // "process" is optional, it is already in script as marker
+            if (!eventJson.is_object() || !eventJson["script"].is_string()
+                || eventJson.object_items().size()
+                       != (eventJson["process"].is_string() ? 2u : 1u)) {
                 onParseError(QStringLiteral("event"));
                 return;
             }
-            onNewUserAppEvent(QString::fromUtf8(eventJson.object_items()
-                                                    .begin()
-                                                    ->second.string_value()
-                                                    .c_str()));
+            onNewUserAppEvent(QString::fromUtf8(
+                eventJson["script"].string_value().c_str()));
         } else if (elm.is_object() && elm.object_items().size() == 1u
                    && elm.object_items().begin()->first == "app errors") {
             auto it = elm.object_items().begin();
@@ -102,6 +383,15 @@ void parseOutputFromMonkeyApp(
             }
             onUserAppError(
                 QString::fromUtf8(it->second.string_value().c_str()));
+        } else if (elm.is_object() && elm.object_items().size() == 1u
+                   && elm.object_items().begin()->first == "script error") {
+            auto it = elm.object_items().begin();
+            if (!it->second.is_string()) {
+                onParseError(QStringLiteral("script error"));
+                return;
+            }
+            onScriptError(
+                QString::fromUtf8(it->second.string_value().c_str()));
         } else if (elm.is_object() && elm.object_items().size() == 1u
                    && elm.object_items().begin()->first == "script logs") {
             auto it = elm.object_items().begin();
@@ -116,6 +406,35 @@ void parseOutputFromMonkeyApp(
     }
 }
 
+void JsonLineFramer::feed(const char *data, size_t len,
+                          const OnMessage &onMessage)
+{
+    auto emitMessage = [&onMessage](const char *msg, size_t msgLen) {
+        if (msgLen > 0 && msg[msgLen - 1] == '\r')
+            --msgLen;
+        if (msgLen > 0)
+            onMessage(msg, msgLen);
+    };
+    const char *const end = data + len;
+    while (data != end) {
+        auto eol = static_cast<const char *>(
+            std::memchr(data, '\n', static_cast<size_t>(end - data)));
+        if (eol == nullptr) {
+            partial_.append(data, static_cast<size_t>(end - data));
+            return;
+        }
+        if (partial_.empty()) {
+            // whole message in new data, no need to copy it
+            emitMessage(data, static_cast<size_t>(eol - data));
+        } else {
+            partial_.append(data, static_cast<size_t>(eol - data));
+            emitMessage(partial_.data(), partial_.size());
+            partial_.clear();
+        }
+        data = eol + 1;
+    }
+}
+
 void parseOutputFromGui(
     const json11::string_view &data, size_t &parserStopPos,
     const std::function<void(QString, QString)> &onRunScript,
@@ -150,4 +469,135 @@ void parseOutputFromGui(
         }
     }
 }
+
+void parseLineFromGui(const char *line, size_t len,
+                      const std::function<void(QString, QString)> &onRunScript,
+                      const std::function<void(QString)> &onParseError)
+{
+    size_t stopPos = 0;
+    parseOutputFromGui({line, len}, stopPos, onRunScript, onParseError);
+    checkWholeLineParsed(line, len, stopPos, onParseError);
+}
+
+void parseLineFromMonkeyApp(
+    const char *line, size_t len,
+    const std::function<void(QString)> &onNewUserAppEvent,
+    const std::function<void(QString)> &onUserAppError,
+    const std::function<void(QString)> &onScriptError,
+    const std::function<void()> &onScriptEnd,
+    const std::function<void(QString)> &onScriptLog,
+    const std::function<void(QString)> &onParseError)
+{
+    size_t stopPos = 0;
+    parseOutputFromMonkeyApp({line, len}, stopPos, onNewUserAppEvent,
+                             onUserAppError, onScriptError, onScriptEnd,
+                             onScriptLog, onParseError);
+    checkWholeLineParsed(line, len, stopPos, onParseError);
+}
+
+bool BinaryFramer::feed(const char *data, size_t len, const OnFrame &onFrame)
+{
+    if (damaged_)
+        return false;
+    const char *const end = data + len;
+    if (!partial_.empty()) {
+        size_t avail = static_cast<size_t>(end - data);
+        if (partial_.size() < binaryHeaderSize) {
+            size_t take = binaryHeaderSize - partial_.size();
+            if (take > avail)
+                take = avail;
+            partial_.append(data, take);
+            data += take;
+            avail -= take;
+            if (partial_.size() < binaryHeaderSize)
+                return true;
+        }
+        const uint32_t payloadLen = readUInt32(partial_.data() + 4);
+        if (payloadLen > maxBinaryPayload) {
+            damaged_ = true;
+            return false;
+        }
+        size_t take = binaryHeaderSize + payloadLen - partial_.size();
+        if (take > avail)
+            take = avail;
+        partial_.append(data, take);
+        data += take;
+        if (partial_.size() < binaryHeaderSize + payloadLen)
+            return true;
+        onFrame(static_cast<MessageType>(readUInt32(partial_.data())),
+                partial_.data() + binaryHeaderSize, payloadLen);
+        partial_.clear();
+    }
+    while (static_cast<size_t>(end - data) >= binaryHeaderSize) {
+        const uint32_t payloadLen = readUInt32(data + 4);
+        if (payloadLen > maxBinaryPayload) {
+            damaged_ = true;
+            return false;
+        }
+        if (static_cast<size_t>(end - data) - binaryHeaderSize < payloadLen)
+            break;
+        // whole frame in new data, no need to copy it
+        onFrame(static_cast<MessageType>(readUInt32(data)),
+                data + binaryHeaderSize, payloadLen);
+        data += binaryHeaderSize + payloadLen;
+    }
+    partial_.append(data, static_cast<size_t>(end - data));
+    return true;
+}
+
+void parseBinaryFrameFromGui(
+    MessageType type, const char *payload, size_t len,
+    const std::function<void(QString, QString)> &onRunScript,
+    const std::function<void(QString)> &onParseError)
+{
+    // as in json, unknown messages are ignored
+    if (type != MessageType::RunScript)
+        return;
+    QString fields[2];
+    if (!parseBinaryFields(type, payload, len, fields)) {
+        onParseError(QStringLiteral("run script"));
+        return;
+    }
+    onRunScript(std::move(fields[0]), std::move(fields[1]));
+}
+
+void parseBinaryFrameFromMonkeyApp(
+    MessageType type, const char *payload, size_t len,
+    const std::function<void(QString)> &onNewUserAppEvent,
+    const std::function<void(QString)> &onUserAppError,
+    const std::function<void(QString)> &onScriptError,
+    const std::function<void()> &onScriptEnd,
+    const std::function<void(QString)> &onScriptLog,
+    const std::function<void(QString)> &onParseError)
+{
+    const MessageDef *def = findMessageDef(type);
+    // as in json, unknown messages and application output are ignored
+    if (def == nullptr || type == MessageType::UserAppOutput
+        || type == MessageType::RunScript)
+        return;
+    QString fields[2];
+    if (!parseBinaryFields(type, payload, len, fields)) {
+        onParseError(QString::fromLatin1(def->name));
+        return;
+    }
+    switch (type) {
+    case MessageType::UserAppEvent:
+        onNewUserAppEvent(std::move(fields[0]));
+        break;
+    case MessageType::UserAppErrors:
+        onUserAppError(std::move(fields[0]));
+        break;
+    case MessageType::ScriptError:
+        onScriptError(std::move(fields[0]));
+        break;
+    case MessageType::ScriptEnd:
+        onScriptEnd();
+        break;
+    case MessageType::ScriptLog:
+        onScriptLog(std::move(fields[0]));
+        break;
+    default:
+        break;
+    }
+}
 } // namespace qt_monkey_app
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <initializer_list>
 #include <string>
 
 #include <QtCore/QString>
@@ -12,9 +15,65 @@ class string_view;
 
 namespace qt_monkey_app
 {
-std::string createPacketFromUserAppEvent(const QString &scriptLines);
+//! encoding of gui<->monkey protocol, see README.md for format
+enum class Protocol { Json, Binary };
+
+/**
+ * Messages of gui<->monkey protocol, value is type of binary frame.
+ * Names and fields of messages are described by the same table
+ * for both encodings.
+ */
+enum class MessageType : uint32_t {
+    UserAppEvent = 1,
+    UserAppOutput = 2,
+    UserAppErrors = 3,
+    ScriptEnd = 4,
+    ScriptLog = 5,
+    RunScript = 6,
+    ScriptError = 7,
+};
+
+/**
+ * Write packets of gui<->monkey protocol directly
+ * to the end of buffer, without intermediate json objects or
+ * UTF-8 copies of strings, so buffer can be reused for many packets.
+ * Json packets are written without delimiter.
+ */
+class PacketWriter final
+{
+public:
+    explicit PacketWriter(std::string &out, Protocol protocol = Protocol::Json)
+        : out_(out), protocol_(protocol)
+    {
+    }
+    //! @see createPacketFromUserAppEvent
+    void userAppEvent(const QString &scriptLines,
+                      const QString &processName = QString());
+    void userAppOutput(const QString &stdOutLines);
+    //! stderr of user application
+    void userAppErrors(const QString &errMsg);
+    void scriptError(const QString &errMsg);
+    void scriptEnd();
+    void scriptLog(const QString &logMsg);
+    void runScript(const QString &script, const QString &scriptFileName);
+
+private:
+    std::string &out_;
+    Protocol protocol_;
+
+    void write(MessageType type,
+               std::initializer_list<const QString *> fields);
+};
+
+/**
+ * @param processName name of process, where event happened,
+ * empty for main process
+ */
+std::string createPacketFromUserAppEvent(const QString &scriptLines,
+                                        const QString &processName = QString());
 std::string createPacketFromUserAppOutput(const QString &stdOutLines);
 std::string createPacketFromUserAppErrors(const QString &errOut);
+std::string createPacketFromScriptError(const QString &errMsg);
 std::string createPacketFromScriptEnd();
 std::string createPacketFromUserAppScriptLog(const QString &logMsg);
 std::string createPacketFromRunScript(const QString &script,
@@ -29,6 +88,80 @@ void parseOutputFromMonkeyApp(
     const json11::string_view &data, size_t &stopPos,
     const std::function<void(QString)> &onNewUserAppEvent,
     const std::function<void(QString)> &onUserAppError,
+    const std::function<void(QString)> &onScriptError,
+    const std::function<void()> &onScriptEnd,
+    const std::function<void(QString)> &onScriptLog,
+    const std::function<void(QString)> &onParseError);
+
+//@{
+/**
+ * Parse one message from JsonLineFramer. Line is always whole message,
+ * so it is never passed again, and not parsed part of it is reported
+ * by onParseError instead of silent loss
+ */
+void parseLineFromGui(const char *line, size_t len,
+                      const std::function<void(QString, QString)> &onRunScript,
+                      const std::function<void(QString)> &onParseError);
+void parseLineFromMonkeyApp(
+    const char *line, size_t len,
+    const std::function<void(QString)> &onNewUserAppEvent,
+    const std::function<void(QString)> &onUserAppError,
+    const std::function<void(QString)> &onScriptError,
+    const std::function<void()> &onScriptEnd,
+    const std::function<void(QString)> &onScriptLog,
+    const std::function<void(QString)> &onParseError);
+//@}
+
+/**
+ * Split stream of newline-delimited json messages.
+ * Only new data is scanned for delimiter, and every message
+ * is passed to callback exactly once, so parsing of big message
+ * that arrives by parts is not quadratic.
+ */
+class JsonLineFramer final
+{
+public:
+    //! message without delimiter, empty lines are skipped
+    using OnMessage = std::function<void(const char *data, size_t len)>;
+    void feed(const char *data, size_t len, const OnMessage &onMessage);
+    //! size of not completed message
+    size_t pendingSize() const { return partial_.size(); }
+
+private:
+    std::string partial_;
+};
+
+/**
+ * Split stream of binary frames. Frames that are whole inside of new data
+ * are passed to callback without copying.
+ */
+class BinaryFramer final
+{
+public:
+    using OnFrame = std::function<void(MessageType type, const char *payload,
+                                       size_t len)>;
+    //! @return false if stream is damaged, all data after that is ignored
+    bool feed(const char *data, size_t len, const OnFrame &onFrame);
+    //! size of not completed frame
+    size_t pendingSize() const { return partial_.size(); }
+
+private:
+    std::string partial_;
+    bool damaged_ = false;
+};
+
+//! binary analog of parseOutputFromGui for one frame
+void parseBinaryFrameFromGui(
+    MessageType type, const char *payload, size_t len,
+    const std::function<void(QString, QString)> &onRunScript,
+    const std::function<void(QString)> &onParseError);
+
+//! binary analog of parseOutputFromMonkeyApp for one frame
+void parseBinaryFrameFromMonkeyApp(
+    MessageType type, const char *payload, size_t len,
+    const std::function<void(QString)> &onNewUserAppEvent,
+    const std::function<void(QString)> &onUserAppError,
+    const std::function<void(QString)> &onScriptError,
     const std::function<void()> &onScriptEnd,
     const std::function<void(QString)> &onScriptLog,
     const std::function<void(QString)> &onParseError);
@@ -79,33 +79,34 @@ void QtMonkeyAppCtrl::monkeyAppNewOutput()
 {
     qDebug("%s: begin", Q_FUNC_INFO);
     const QByteArray out = qtmonkeyApp_.readAllStandardOutput();
-    jsonFromMonkey_.append(out);
-    qDebug("%s: json |%s|", Q_FUNC_INFO, qPrintable(jsonFromMonkey_));
-
-    std::string::size_type parserStopPos;
-    qt_monkey_app::parseOutputFromMonkeyApp(
-        {jsonFromMonkey_.constData(),
-         static_cast<size_t>(jsonFromMonkey_.size())},
-        parserStopPos,
-        [this](QString eventScriptLines) {
-            emit monkeyAppNewEvent(std::move(eventScriptLines));
-        },
-        [this](QString userAppErrors) {
-            emit monkeyUserAppError(std::move(userAppErrors));
-        },
-        [this]() { // on script end
-            emit monkeyScriptEnd();
-        },
-        [this](QString scriptLog) { emit monkeScriptLog(scriptLog); },
-        [this](QString data) {
-            qtmonkeyApp_.kill();
-            emit monkeyAppFinishedSignal(
-                T_("Internal Error: problem with monkey<->gui protocol: %1")
-                    .arg(data));
+    qDebug("%s: json |%s|", Q_FUNC_INFO, out.constData());
+
+    monkeyOutFramer_.feed(
+        out.constData(), static_cast<size_t>(out.size()),
+        [this](const char *msg, size_t len) {
+            qt_monkey_app::parseLineFromMonkeyApp(
+                msg, len,
+                [this](QString eventScriptLines) {
+                    emit monkeyAppNewEvent(std::move(eventScriptLines));
+                },
+                [this](QString userAppErrors) {
+                    emit monkeyUserAppError(std::move(userAppErrors));
+                },
+                [this](QString scriptError) {
+                    emit monkeyUserAppError(std::move(scriptError));
+                },
+                [this]() { // on script end
+                    emit monkeyScriptEnd();
+                },
+                [this](QString scriptLog) { emit monkeScriptLog(scriptLog); },
+                [this](QString data) {
+                    qtmonkeyApp_.kill();
+                    emit monkeyAppFinishedSignal(
+                        T_("Internal Error: problem with monkey<->gui "
+                           "protocol: %1")
+                            .arg(data));
+                });
         });
-
-    if (parserStopPos != 0)
-        jsonFromMonkey_.remove(0, parserStopPos);
 }
 
 void QtMonkeyAppCtrl::monkeyAppNewErrOutput()
@@ -5,6 +5,7 @@
 #include <QtCore/QStringList>
 #include <QtCore/QTimer>
 
+#include "qtmonkey_app_api.hpp"
 #include "ui_qtmonkey_gui.h"
 
 class QtMonkeyAppCtrl
@@ -35,7 +36,7 @@ private slots:
 
 private:
     QProcess qtmonkeyApp_;
-    QByteArray jsonFromMonkey_;
+    qt_monkey_app::JsonLineFramer monkeyOutFramer_;
 };
 
 class QtMonkeyWindow
@@ -11,17 +11,40 @@ std::list<Script> Script::splitToExecutableParts(const QString &fileName,
     std::list<Script> res;
 
     QRegExp rxSplitOrNewLine(
-        QRegExp::escape(QLatin1String("<<<RESTART FROM HERE>>>")) + "|\n");
+        QRegExp::escape(QLatin1String("<<<RESTART FROM HERE>>>")) + "|"
+        + QRegExp::escape(QLatin1String("<<<IN PROCESS"))
+        + "([^>\\n]*)>>>|\n");
     int pos = 0;
     int prevPos = 0;
     int lineno = 1;
     int curLine = 1;
+    QString processName;
+    bool continuesPrevious = false;
+    auto addPart = [&](QString code) {
+        res.emplace_back(fileName, lineno, std::move(code));
+        res.back().setProcessName(processName);
+        res.back().continuesPrevious_ = continuesPrevious;
+    };
     while ((pos = rxSplitOrNewLine.indexIn(scriptCode, pos)) != -1) {
         if (scriptCode[pos] == '\n') {
             ++curLine;
+        } else if (rxSplitOrNewLine.cap(0).startsWith(
+                       QLatin1String("<<<IN PROCESS"))) {
+            const QString code = scriptCode.mid(prevPos, pos - prevPos);
+            // switch of process without code before it, for example
+            // at the begining of file, is not separate part
+            if (!code.trimmed().isEmpty()) {
+                addPart(code);
+                continuesPrevious = true;
+            }
+            processName = rxSplitOrNewLine.cap(1).trimmed();
+            lineno = curLine;
+            prevPos = pos + rxSplitOrNewLine.matchedLength();
         } else {
-            res.emplace_back(fileName, lineno,
-                             scriptCode.mid(prevPos, pos - prevPos));
+            addPart(scriptCode.mid(prevPos, pos - prevPos));
+            // application restarted, so we start from main process
+            processName.clear();
+            continuesPrevious = false;
             lineno = curLine;
             prevPos = pos + rxSplitOrNewLine.matchedLength();
         }
@@ -29,6 +52,6 @@ std::list<Script> Script::splitToExecutableParts(const QString &fileName,
     }
 
     if (prevPos < scriptCode.length())
-        res.emplace_back(fileName, lineno, scriptCode.mid(prevPos));
+        addPart(scriptCode.mid(prevPos));
     return res;
 }
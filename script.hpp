@@ -29,12 +29,22 @@ public:
     const QString &fileName() const { return fileName_; }
     bool runAfterAppStart() const { return runAfterStart_; }
     void setRunAfterAppStart(bool val) { runAfterStart_ = val; }
+    //! process that should run script, empty for main one
+    const QString &processName() const { return processName_; }
+    void setProcessName(QString name) { processName_ = std::move(name); }
+    /**
+     * Part separated from previous one by <<<IN PROCESS name>>>,
+     * so it should run without restart of application
+     */
+    bool continuesPreviousPart() const { return continuesPrevious_; }
 
 private:
     QString fileName_;
     int lineno_ = 1;
     QString code_;
     bool runAfterStart_ = false;
+    QString processName_;
+    bool continuesPrevious_ = false;
 };
 } // namespace Private
 } // namespace qt_monkey_agent
@@ -3,6 +3,7 @@
 
 #include <cassert>
 #include <chrono>
+#include <memory>
 #include <thread>
 
 #include <QAbstractButton>
@@ -27,13 +28,20 @@
 #include <QtScript/QScriptEngine>
 #include <QtTest/QTest>
 
+#include "action_pipeline.hpp"
 #include "agent.hpp"
 #include "common.hpp"
 #include "script_runner.hpp"
+#include "semaphore.hpp"
 #include "user_events_analyzer.hpp"
+#include "widget_index.hpp"
+#include "widget_selector.hpp"
 
 using qt_monkey_agent::Agent;
 using qt_monkey_agent::ScriptAPI;
+using qt_monkey_agent::Private::WidgetIndex;
+using qt_monkey_agent::Private::WidgetSelector;
+using qt_monkey_common::Semaphore;
 
 #ifdef DEBUG_SCRIPT_API
 #define DBGPRINT(fmt, ...) qDebug(fmt, __VA_ARGS__)
@@ -59,43 +67,13 @@ QRect MyLineEdit::adjustedContentsRect(const QLineEdit &le)
     reinterpret_cast<const MyLineEdit &>(le).initStyleOption(&opt);
     return le.style()->subElementRect(QStyle::SE_LineEditContents, &opt, &le);
 }
-static QWidget *bruteForceWidgetSearch(const QString &objectName,
-                                       const QString &className,
-                                       bool shouldBeEnabled)
+static QWidget *doGetWidgetWithSuchName(WidgetIndex &index,
+                                        const WidgetSelector &selector,
+                                        bool shouldBeEnabled, bool mayRescan)
 {
-    const QWidgetList allWdg = QApplication::allWidgets();
-    for (QWidget *widget : allWdg) {
-        if (!className.isEmpty()
-            && className == widget->metaObject()->className()) {
-            DBGPRINT("%s: found widget with class %s, w %s", Q_FUNC_INFO,
-                     qPrintable(className),
-                     widget == nullptr ? "null" : "not null");
-            if (shouldBeEnabled
-                && !(widget->isEnabled() && widget->isVisible()))
-                continue;
-            return widget;
-        }
-        if (widget->objectName() == objectName) {
-            DBGPRINT("%s: found widget %s", Q_FUNC_INFO,
-                     qPrintable(objectName));
-            if (shouldBeEnabled
-                && !(widget->isEnabled() && widget->isVisible()))
-                continue;
-            return widget;
-        }
-    }
-
-    DBGPRINT("(%s, %d): brute force do not give any suitable result",
-             Q_FUNC_INFO, __LINE__);
-    return nullptr;
-}
-
-static QWidget *doGetWidgetWithSuchName(const QString &objectName,
-                                        bool shouldBeEnabled)
-{
-    QStringList names = objectName.split('.');
+    const QVector<WidgetSelector::Segment> &segments = selector.segments();
 
-    if (names.isEmpty()) {
+    if (segments.isEmpty()) {
         DBGPRINT("%s: list of widget's name empty\n", Q_FUNC_INFO);
         return nullptr;
     }
@@ -113,68 +91,33 @@ static QWidget *doGetWidgetWithSuchName(const QString &objectName,
     DBGPRINT("(%s, %d): active Window %s", Q_FUNC_INFO, __LINE__,
              win != nullptr ? qPrintable(win->objectName()) : "nullptr");
 #endif
-    const QString &mainWidgetName = names.first();
+    const WidgetSelector::Segment &mainWidget = segments.first();
     DBGPRINT("(%s, %d): search widget with such name %s", Q_FUNC_INFO, __LINE__,
-             qPrintable(mainWidgetName));
-    QList<QObject *> lst
-        = QCoreApplication::instance()->findChildren<QObject *>(mainWidgetName);
-    if (lst.isEmpty()) {
-        const QWidgetList topLvlWdg = QApplication::topLevelWidgets();
-        for (QWidget *widget : topLvlWdg) {
-            if (mainWidgetName == widget->objectName()) {
-                lst << widget;
-                break;
-            } else {
-                lst = widget->findChildren<QObject *>(mainWidgetName);
-            }
-
-            if (!lst.isEmpty())
-                break;
-        }
-    }
-    const QRegExp class_name_rx("^<class_name=([^>]+)>$");
-    if (lst.isEmpty()) {
-        DBGPRINT("%s: list of widget's name empty, start bruteforce\n",
+             qPrintable(mainWidget.name));
+    // name of class segment is "<class_name=...>", no object has such name
+    QWidget *w = mainWidget.kind == WidgetSelector::Segment::Kind::ClassName
+                     ? nullptr
+                     : index.topmostWithName(mainWidget.name, mayRescan);
+    if (w == nullptr) {
+        DBGPRINT("%s: no widget with such name, search by class\n",
                  Q_FUNC_INFO);
-        //! \todo if there is class name use it in brute search
-        QString className;
-        if (class_name_rx.indexIn(mainWidgetName) != -1)
-            className = class_name_rx.cap(1);
-        QWidget *w = bruteForceWidgetSearch(mainWidgetName, className,
-                                            shouldBeEnabled);
+        w = index.anyWithNameOrClass(mainWidget.name, mainWidget.className,
+                                     shouldBeEnabled, mayRescan);
         if (w == nullptr)
             return nullptr;
-        lst << w;
     }
 
-    //! \todo may be try all variants, instead of lst.first?
-    QWidget *w = qobject_cast<QWidget *>(lst.first());
-    assert(w != nullptr);
     DBGPRINT("%s: we found %s", Q_FUNC_INFO, qPrintable(w->objectName()));
-    names.removeFirst();
 
-    while (!names.isEmpty()) {
+    // only the first segment is searched in index, others are searched
+    // among children of previous one, and there are usually not many of them
+    for (auto segIt = segments.begin() + 1; segIt != segments.end(); ++segIt) {
         const QObjectList &clist = w->children();
-        const QString &el = names.first();
-        QString class_name;
-        int class_order = 0;
-        if (class_name_rx.indexIn(el) != -1) {
-            class_name = class_name_rx.cap(1);
-            const QStringList res
-                = class_name.split(",", QString::SkipEmptyParts);
-            if (res.size() == 0)
-                class_name = "";
-            else
-                class_name = res[0];
-            if (res.size() > 1) {
-                bool ok = false;
-                class_order = res[1].toInt(&ok);
-                if (!ok)
-                    class_order = 0;
-            }
-            DBGPRINT("%s: search object with class: %s, order %d", Q_FUNC_INFO,
-                     qPrintable(class_name), class_order);
-        }
+        const QString &el = segIt->name;
+        const QByteArray &class_name = segIt->className;
+        const int class_order = segIt->order;
+        DBGPRINT("%s: search object with class: %s, order %d", Q_FUNC_INFO,
+                 class_name.constData(), class_order);
         int order = 0;
         QObjectList::const_iterator it;
         for (it = clist.begin(); it != clist.end(); ++it) {
@@ -188,22 +131,21 @@ static QWidget *doGetWidgetWithSuchName(const QString &objectName,
                     continue;
                 if (order++ != class_order)
                     continue;
-
-                names.removeFirst();
                 break;
             }
         }
 
         if (it == clist.end()) {
             DBGPRINT("(%s, %d): Can not find object with such name %s, try "
-                     "brute search",
+                     "search in whole index",
                      Q_FUNC_INFO, __LINE__, qPrintable(el));
-            w = bruteForceWidgetSearch(el, class_name, shouldBeEnabled);
+            w = index.anyWithNameOrClass(el, class_name, shouldBeEnabled,
+                                         mayRescan);
             if (w == nullptr) {
-                DBGPRINT("(%s, %d) brute force failed", Q_FUNC_INFO, __LINE__);
+                DBGPRINT("(%s, %d) search in index failed", Q_FUNC_INFO,
+                         __LINE__);
                 return nullptr;
             }
-            names.removeFirst();
         }
     }
 
@@ -281,6 +223,32 @@ static bool canNotFind(QWidget &w)
     return wdgAtPos == nullptr;
 }
 
+/**
+ * should be called only in GUI thread
+ * @param mayRescan false for waiters, see WidgetIndex::topmostWithName
+ */
+static QWidget *findSuitableWidget(WidgetIndex &index,
+                                   const WidgetSelector &selector,
+                                   bool shouldBeEnabled, bool mayRescan)
+{
+    QWidget *w = doGetWidgetWithSuchName(index, selector, shouldBeEnabled,
+                                         mayRescan);
+    DBGPRINT("%s, %d: doGetWidgetWithSuchName return w '%s'", Q_FUNC_INFO,
+             __LINE__, w != nullptr ? qPrintable(w->objectName()) : "nullptr");
+    if (w != nullptr && canNotFind(*w)) {
+        DBGPRINT("%s: canNotFind return true", Q_FUNC_INFO);
+        return nullptr;
+    }
+    if (w != nullptr && shouldBeEnabled
+        && !(w->isVisible() && w->isEnabled())) {
+        DBGPRINT("%s, %d: w '%s', v %d e %d", Q_FUNC_INFO, __LINE__,
+                 qPrintable(w->objectName()), static_cast<int>(w->isVisible()),
+                 static_cast<int>(w->isEnabled()));
+        return nullptr;
+    }
+    return w;
+}
+
 static QString clickOnItemInGuiThread(qt_monkey_agent::Agent &agent,
                                       const QVector<int> &idxPos,
                                       QAbstractItemView *view, bool isDblClick)
@@ -550,39 +518,66 @@ QWidget *qt_monkey_agent::getWidgetWithSuchName(
     qt_monkey_agent::Agent &agent, const QString &objectName,
     const int maxTimeToFindWidgetSec, bool shouldBeEnabled)
 {
-    DBGPRINT("%s begin, search %s", Q_FUNC_INFO, qPrintable(objectName));
-    QWidget *w = nullptr;
+    return getWidgetWithSuchName(agent, *WidgetSelector::compile(objectName),
+                                 maxTimeToFindWidgetSec, shouldBeEnabled);
+}
 
-    const int maxAttempts
-        = (maxTimeToFindWidgetSec * 1000) / sleepTimeForWaitWidgetMs + 1;
-    for (int i = 0; i < maxAttempts; ++i) {
-        agent.runCodeInGuiThreadSync([&w, &objectName, shouldBeEnabled] {
-            w = doGetWidgetWithSuchName(objectName, shouldBeEnabled);
-            DBGPRINT("%s, %d: doGetWidgetWithSuchName return w '%s'",
-                     Q_FUNC_INFO, __LINE__,
-                     w != nullptr ? qPrintable(w->objectName()) : "nullptr");
-            if (w != nullptr && canNotFind(*w)) {
-                DBGPRINT("%s: canNotFind return true", Q_FUNC_INFO);
-                w = nullptr;
-            }
-            return QString();
+QWidget *qt_monkey_agent::getWidgetWithSuchName(
+    qt_monkey_agent::Agent &agent, const WidgetSelector &selector,
+    const int maxTimeToFindWidgetSec, bool shouldBeEnabled)
+{
+    DBGPRINT("%s begin, search %s", Q_FUNC_INFO, qPrintable(selector.id()));
+
+    // instead of polling, register waiter in GUI thread, it is rechecked
+    // after each change of widgets that may affect result of search
+    struct WaitState final {
+        Semaphore found{0};
+        QWidget *widget = nullptr;
+    };
+    auto state = std::make_shared<WaitState>();
+    quint64 waiterId = 0;
+    const bool waiting = agent.callInGuiThreadSync([&agent, &selector,
+                                                    maxTimeToFindWidgetSec,
+                                                    shouldBeEnabled, state,
+                                                    &waiterId] {
+        WidgetIndex &index = agent.widgetIndex();
+        state->widget
+            = findSuitableWidget(index, selector, shouldBeEnabled, true);
+        if (state->widget != nullptr || maxTimeToFindWidgetSec <= 0)
+            return false;
+        // waiter always removed before return, so it is safe
+        // to capture selector by reference
+        waiterId = index.addWaiter([&index, &selector, shouldBeEnabled,
+                                    state] {
+            state->widget
+                = findSuitableWidget(index, selector, shouldBeEnabled, false);
+            if (state->widget == nullptr)
+                return false;
+            state->found.release();
+            return true;
         });
+        return true;
+    });
+    if (!waiting) {
+        DBGPRINT("%s: widget %s", Q_FUNC_INFO,
+                 state->widget != nullptr ? "found" : "not found");
+        return state->widget;
+    }
 
-        if (w == nullptr
-            || (shouldBeEnabled && !(w->isVisible() && w->isEnabled()))) {
-            DBGPRINT("%s, %d: w '%s', v %d e %d", Q_FUNC_INFO, __LINE__,
-                     w != nullptr ? qPrintable(w->objectName()) : "nullptr",
-                     static_cast<int>(w ? w->isVisible() : 0),
-                     static_cast<int>(w ? w->isEnabled() : 0));
-            w = nullptr;
-            std::this_thread::sleep_for(
-                std::chrono::milliseconds(sleepTimeForWaitWidgetMs));
-        } else {
-            DBGPRINT("%s: widget found", Q_FUNC_INFO);
-            break;
+    if (!state->found.tryAcquire(
+            1, std::chrono::seconds(maxTimeToFindWidgetSec))) {
+        agent.callInGuiThreadSync([&agent, waiterId] {
+            agent.widgetIndex().removeWaiter(waiterId);
+            return true;
+        });
+        // waiter can finish between timeout and its removing
+        if (!state->found.tryAcquire(1, std::chrono::milliseconds(0))) {
+            DBGPRINT("%s: timeout", Q_FUNC_INFO);
+            return nullptr;
         }
     }
-    return w;
+    DBGPRINT("%s: widget found", Q_FUNC_INFO);
+    return state->widget;
 }
 
 ScriptAPI::ScriptAPI(Agent &agent, QObject *parent)
@@ -590,6 +585,75 @@ ScriptAPI::ScriptAPI(Agent &agent, QObject *parent)
 {
 }
 
+const std::shared_ptr<const WidgetSelector> &
+ScriptAPI::compiledSelector(const QString &id)
+{
+    auto it = selectors_.find(id);
+    if (it == selectors_.end())
+        it = selectors_.insert(id, WidgetSelector::compile(id));
+    return *it;
+}
+
+void ScriptAPI::runAction(const QString &widgetName, QString notFoundMsg,
+                          std::function<QString(QWidget &)> action)
+{
+    std::shared_ptr<const WidgetSelector> selector
+        = compiledSelector(widgetName);
+    if (agent_.pipelineMode()) {
+        Agent *agent = &agent_;
+        agent_.actionPipeline().post(
+            [agent, selector](bool mayRescan) {
+                return findSuitableWidget(agent->widgetIndex(), *selector,
+                                          true, mayRescan);
+            },
+            waitWidgetAppearTimeoutSec_, std::move(notFoundMsg),
+            std::move(action));
+        return;
+    }
+
+    QWidget *w = getWidgetWithSuchName(agent_, *selector,
+                                       waitWidgetAppearTimeoutSec_, true);
+    if (w == nullptr) {
+        agent_.throwScriptError(std::move(notFoundMsg));
+        return;
+    }
+    QString errMsg = agent_.runCodeInGuiThreadSyncWithTimeout(
+        [w, action] { return action(*w); }, newEventLoopWaitTimeoutSecs_);
+    if (!errMsg.isEmpty()) {
+        DBGPRINT("%s: error %s", Q_FUNC_INFO, qPrintable(errMsg));
+        agent_.throwScriptError(std::move(errMsg));
+    }
+}
+
+bool ScriptAPI::syncPipeline() const
+{
+    if (!agent_.pipelineMode())
+        return true;
+    QString errMsg = agent_.actionPipeline().sync();
+    if (!errMsg.isEmpty()) {
+        DBGPRINT("%s: error %s", Q_FUNC_INFO, qPrintable(errMsg));
+        agent_.throwScriptError(std::move(errMsg));
+        return false;
+    }
+    // the same as Step do for not pipelined actions
+    agent_.waitForGuiIdle(std::chrono::milliseconds(120));
+    return true;
+}
+
+void ScriptAPI::setPipelineEnabled(bool val)
+{
+    Step step(agent_, true);
+    if (!val)
+        syncPipeline();
+    agent_.setPipelineMode(val);
+}
+
+void ScriptAPI::sync()
+{
+    Step step(agent_, true);
+    syncPipeline();
+}
+
 void ScriptAPI::log(const QString &msgStr)
 {
     agent_.sendToLog(std::move(msgStr));
@@ -599,15 +663,6 @@ void ScriptAPI::doMouseClick(const QString &widgetName,
                              const QString &buttonName, int x, int y,
                              bool doubleClick)
 {
-    QWidget *w = getWidgetWithSuchName(agent_, widgetName,
-                                       waitWidgetAppearTimeoutSec_, true);
-
-    if (w == nullptr) {
-        agent_.throwScriptError(
-            QStringLiteral("Can not find widget with such name %1")
-                .arg(widgetName));
-        return;
-    }
     Qt::MouseButton btn;
     if (!stringToMouseButton(buttonName, btn)) {
         agent_.throwScriptError(
@@ -617,14 +672,14 @@ void ScriptAPI::doMouseClick(const QString &widgetName,
 
     const QPoint pos{x, y};
     Agent *agent = &agent_;
-    agent_.runCodeInGuiThreadSyncWithTimeout(
-        [pos, doubleClick, w, btn, agent] {
-            assert(w != nullptr);
-            assert(agent != nullptr);
-            clickInGuiThread(*agent, pos, *w, btn, doubleClick);
-            return QString();
-        },
-        newEventLoopWaitTimeoutSecs_);
+    runAction(widgetName,
+              QStringLiteral("Can not find widget with such name %1")
+                  .arg(widgetName),
+              [pos, doubleClick, btn, agent](QWidget &w) {
+                  assert(agent != nullptr);
+                  clickInGuiThread(*agent, pos, w, btn, doubleClick);
+                  return QString();
+              });
 }
 
 void ScriptAPI::doClickItem(const QString &objectName, const QString &itemName,
@@ -632,61 +687,50 @@ void ScriptAPI::doClickItem(const QString &objectName, const QString &itemName,
 {
     DBGPRINT("%s: begin object_name %s", Q_FUNC_INFO, qPrintable(objectName));
 
-    QWidget *w = getWidgetWithSuchName(agent_, objectName,
-                                       waitWidgetAppearTimeoutSec_, true);
-    if (w == nullptr) {
-        agent_.throwScriptError(
-            QStringLiteral("Can not find widget with such name %1")
-                .arg(objectName));
-        return;
-    }
-
-    if (qobject_cast<QMenu *>(w) == nullptr
-        && qobject_cast<QTreeWidget *>(w) == nullptr
-        && qobject_cast<QComboBox *>(w) == nullptr
-        && qobject_cast<QTabBar *>(w) == nullptr
-        && qobject_cast<QListWidget *>(w) == nullptr
-        && qobject_cast<QListView *>(w) == nullptr) {
-        agent_.throwScriptError(QStringLiteral(
-            "Can not activateItem for object not: QMenu or "
-            "QTreeWidget or QComboBox or QTabBar or QListWidget or "
-            "QListView class"));
-        return;
-    }
     Agent *agent = &agent_;
-    QString errMsg = agent_.runCodeInGuiThreadSyncWithTimeout(
-        [w, isDblClick, itemName, searchItemFlag, agent] {
+    runAction(
+        objectName,
+        QStringLiteral("Can not find widget with such name %1").arg(objectName),
+        [isDblClick, itemName, searchItemFlag, agent](QWidget &w) {
             assert(agent != nullptr);
-            return activateItemInGuiThread(*agent, w, itemName, isDblClick,
+            if (qobject_cast<QMenu *>(&w) == nullptr
+                && qobject_cast<QTreeWidget *>(&w) == nullptr
+                && qobject_cast<QComboBox *>(&w) == nullptr
+                && qobject_cast<QTabBar *>(&w) == nullptr
+                && qobject_cast<QListWidget *>(&w) == nullptr
+                && qobject_cast<QListView *>(&w) == nullptr)
+                return QStringLiteral(
+                    "Can not activateItem for object not: QMenu or "
+                    "QTreeWidget or QComboBox or QTabBar or QListWidget or "
+                    "QListView class");
+            return activateItemInGuiThread(*agent, &w, itemName, isDblClick,
                                            searchItemFlag);
-        },
-        newEventLoopWaitTimeoutSecs_);
-    if (!errMsg.isEmpty()) {
-        DBGPRINT("%s: error %s", Q_FUNC_INFO, qPrintable(errMsg));
-        agent_.throwScriptError(std::move(errMsg));
-    }
+        });
     DBGPRINT("%s: done", Q_FUNC_INFO);
 }
 
 void ScriptAPI::mouseClick(const QString &widgetName, const QString &button,
                            int x, int y)
 {
-    Step step(agent_);
+    Step step(agent_, true);
     doMouseClick(widgetName, button, x, y, false);
 }
 
 void ScriptAPI::mouseDClick(const QString &widgetName, const QString &button,
                             int x, int y)
 {
-    Step step(agent_);
+    Step step(agent_, true);
     doMouseClick(widgetName, button, x, y, true);
 }
 
 void ScriptAPI::activateItem(const QString &widget, const QString &actionName)
 {
-    Step step(agent_);
+    Step step(agent_, true);
 #ifdef Q_OS_MAC
     {
+        // menu actions on Mac are triggered directly, so not pipelined
+        if (!syncPipeline())
+            return;
         auto ptr = agent_.menuItemsOnMac_.get();
         auto range = ptr->equal_range(widget);
         for (auto it = range.first; it != range.second; ++it)
@@ -710,29 +754,22 @@ void ScriptAPI::activateItem(const QString &widget, const QString &actionName)
 void ScriptAPI::activateItem(const QString &widget, const QString &actionName,
                              const QString &searchFlags)
 {
-    Step step(agent_);
+    Step step(agent_, true);
     doClickItem(widget, actionName, false, matchFlagFromString(searchFlags));
 }
 
 void ScriptAPI::expandItemInTree(const QString &treeWidgetName,
                                  const QString &itemName)
 {
-    Step step(agent_);
-    QWidget *w = getWidgetWithSuchName(agent_, treeWidgetName,
-                                       waitWidgetAppearTimeoutSec_, true);
-    if (w == nullptr) {
-        agent_.throwScriptError(
-            QStringLiteral("Can not find such widget %1").arg(treeWidgetName));
-        return;
-    }
-    auto treeWidget = qobject_cast<QTreeWidget *>(w);
-    if (treeWidget == nullptr) {
-        agent_.throwScriptError(
-            QStringLiteral("%1 is not QTreeWidget").arg(treeWidgetName));
-        return;
-    }
-    QString errMsg = agent_.runCodeInGuiThreadSyncWithTimeout(
-        [itemName, treeWidget] {
+    Step step(agent_, true);
+    runAction(
+        treeWidgetName,
+        QStringLiteral("Can not find such widget %1").arg(treeWidgetName),
+        [itemName, treeWidgetName](QWidget &w) {
+            auto treeWidget = qobject_cast<QTreeWidget *>(&w);
+            if (treeWidget == nullptr)
+                return QStringLiteral("%1 is not QTreeWidget")
+                    .arg(treeWidgetName);
             QList<QTreeWidgetItem *> til = treeWidget->findItems(
                 itemName, Qt::MatchStartsWith | Qt::MatchRecursive);
             if (til.isEmpty()) {
@@ -742,13 +779,7 @@ void ScriptAPI::expandItemInTree(const QString &treeWidgetName,
             QTreeWidgetItem *ti = til.first();
             treeWidget->expandItem(ti);
             return QString();
-        },
-        newEventLoopWaitTimeoutSecs_);
-
-    if (!errMsg.isEmpty()) {
-        DBGPRINT("%s: error %s", Q_FUNC_INFO, qPrintable(errMsg));
-        agent_.throwScriptError(std::move(errMsg));
-    }
+        });
 }
 
 void ScriptAPI::Wait(int ms)
@@ -757,12 +788,21 @@ void ScriptAPI::Wait(int ms)
     std::this_thread::sleep_for(std::chrono::milliseconds(ms));
 }
 
-ScriptAPI::Step::Step(Agent &agent)
+ScriptAPI::Step::Step(Agent &agent, bool pipelined)
 {
     agent.scriptCheckPoint();
     qApp->processEvents(QEventLoop::ExcludeUserInputEvents);
-    std::this_thread::sleep_for(
-        std::chrono::milliseconds(agent.demonstrationMode() ? 200 : 120));
+    if (agent.demonstrationMode()) {
+        // user should see what happens, so fixed pause
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        return;
+    }
+    // action will wait for previous ones inside GUI thread
+    if (pipelined && agent.pipelineMode())
+        return;
+    // previous action may be still processing, but do not wait for it
+    // longer than it was with fixed pause
+    agent.waitForGuiIdle(std::chrono::milliseconds(120));
 }
 
 ScriptAPI::Step::~Step() {}
@@ -770,29 +810,10 @@ ScriptAPI::Step::~Step() {}
 void ScriptAPI::activateItemInView(const QString &widgetName,
                                    const QList<QVariant> &vpos)
 {
-    Step step(agent_);
+    Step step(agent_, true);
 
     DBGPRINT("%s: begin widget %s", Q_FUNC_INFO, qPrintable(widgetName));
 
-    QWidget *w = getWidgetWithSuchName(agent_, widgetName,
-                                       waitWidgetAppearTimeoutSec_, true);
-    if (w == nullptr) {
-        DBGPRINT("%s: can not find widget", Q_FUNC_INFO);
-        agent_.throwScriptError(
-            QStringLiteral("Can not find widget with such name %1")
-                .arg(widgetName));
-        return;
-    }
-    auto view = qobject_cast<QAbstractItemView *>(w);
-
-    if (view == nullptr) {
-        DBGPRINT("%s: can not (dbl)click in not QAbstractItemView",
-                 Q_FUNC_INFO);
-        agent_.throwScriptError(QStringLiteral(
-            "Can not activate(double click) in not QAbstractItemView widget"));
-        return;
-    }
-
     if (vpos.size() % 2) {
         DBGPRINT("%s: wrong position", Q_FUNC_INFO);
         agent_.throwScriptError(
@@ -807,38 +828,27 @@ void ScriptAPI::activateItemInView(const QString &widgetName,
         pos.push_back(var.toInt());
     }
     Agent *agent = &agent_;
-    QString errMsg = agent_.runCodeInGuiThreadSyncWithTimeout(
-        [pos, view, agent] {
-            assert(agent != nullptr);
-            return clickOnItemInGuiThread(*agent, pos, view, false);
-        },
-        newEventLoopWaitTimeoutSecs_);
-
-    if (!errMsg.isEmpty()) {
-        DBGPRINT("%s: error %s", Q_FUNC_INFO, qPrintable(errMsg));
-        agent_.throwScriptError(std::move(errMsg));
-    }
+    runAction(widgetName,
+              QStringLiteral("Can not find widget with such name %1")
+                  .arg(widgetName),
+              [pos, agent](QWidget &w) {
+                  assert(agent != nullptr);
+                  auto view = qobject_cast<QAbstractItemView *>(&w);
+                  if (view == nullptr) {
+                      DBGPRINT("%s: can not (dbl)click in not "
+                               "QAbstractItemView",
+                               Q_FUNC_INFO);
+                      return QStringLiteral("Can not activate(double click) "
+                                            "in not QAbstractItemView widget");
+                  }
+                  return clickOnItemInGuiThread(*agent, pos, view, false);
+              });
 }
 
 void ScriptAPI::expandItemInTreeView(const QString &treeName,
                                      const QList<QVariant> &vpos)
 {
-    Step step(agent_);
-    QWidget *w = getWidgetWithSuchName(agent_, treeName,
-                                       waitWidgetAppearTimeoutSec_, true);
-    if (w == nullptr) {
-        agent_.throwScriptError(
-            QStringLiteral("Can not find such widget %1").arg(treeName));
-        return;
-    }
-
-    auto view = qobject_cast<QTreeView *>(w);
-    if (view == nullptr) {
-        DBGPRINT("%s: can not (dbl)click in not QTreeView", Q_FUNC_INFO);
-        agent_.throwScriptError(QStringLiteral(
-            "Can not activate(double click) in not QTreeView widget"));
-        return;
-    }
+    Step step(agent_, true);
 
     if (vpos.size() % 2) {
         agent_.throwScriptError(
@@ -852,8 +862,16 @@ void ScriptAPI::expandItemInTreeView(const QString &treeName,
     for (const QVariant &var : vpos) {
         pos.push_back(var.toInt());
     }
-    QString errMsg = agent_.runCodeInGuiThreadSyncWithTimeout(
-        [view, pos] {
+    runAction(
+        treeName, QStringLiteral("Can not find such widget %1").arg(treeName),
+        [pos](QWidget &w) {
+            auto view = qobject_cast<QTreeView *>(&w);
+            if (view == nullptr) {
+                DBGPRINT("%s: can not (dbl)click in not QTreeView",
+                         Q_FUNC_INFO);
+                return QStringLiteral(
+                    "Can not activate(double click) in not QTreeView widget");
+            }
             QAbstractItemModel *model = view->model();
             if (model == nullptr)
                 return QStringLiteral(
@@ -863,33 +881,17 @@ void ScriptAPI::expandItemInTreeView(const QString &treeName,
             posToModelIndex(model, pos, mi);
             view->setExpanded(mi, true);
             return QString();
-        },
-        newEventLoopWaitTimeoutSecs_);
-
-    if (!errMsg.isEmpty()) {
-        DBGPRINT("%s: error %s", Q_FUNC_INFO, qPrintable(errMsg));
-        agent_.throwScriptError(std::move(errMsg));
-    }
+        });
 }
 
 void ScriptAPI::keyClick(const QString &widgetName, const QString &keyseqStr,
                          const QString &real_syms)
 {
-    Step step(agent_);
+    Step step(agent_, true);
 
     DBGPRINT("%s begin name %s, keys %s", Q_FUNC_INFO, qPrintable(widgetName),
              qPrintable(keyseqStr));
 
-    QWidget *w = getWidgetWithSuchName(agent_, widgetName,
-                                       waitWidgetAppearTimeoutSec_, true);
-
-    if (w == nullptr) {
-        agent_.throwScriptError(
-            QStringLiteral("Can not find widget with such name %1")
-                .arg(widgetName));
-        return;
-    }
-
     const QKeySequence keySeq = QKeySequence::fromString(keyseqStr);
     if (keySeq.isEmpty()) {
         agent_.throwScriptError(
@@ -900,44 +902,31 @@ void ScriptAPI::keyClick(const QString &widgetName, const QString &keyseqStr,
     for (decltype(keySeq.count()) i = 0;
          keySeq.count() > 0 && i < (keySeq.count() - 1); ++i)
         modifiers |= static_cast<Qt::KeyboardModifier>(keySeq[i]);
-    QString errMsg = agent_.runCodeInGuiThreadSyncWithTimeout(
-        [w, keySeq, modifiers, real_syms] {
-            if (!w->hasFocus())
-                w->setFocus(Qt::ShortcutFocusReason);
-            DBGPRINT("%s: key(%s) click for widget", Q_FUNC_INFO,
-                     qPrintable(keySeq.toString()));
-            auto ascii_key = static_cast<Qt::Key>(keySeq[keySeq.count() - 1]);
-            QTest::sendKeyEvent(QTest::KeyAction::Click, w, ascii_key,
-                                real_syms, modifiers);
-            DBGPRINT("%s: key(%s) click for widget DONE", Q_FUNC_INFO,
-                     qPrintable(keySeq.toString()));
-            return QString();
-        },
-        newEventLoopWaitTimeoutSecs_);
-
-    if (!errMsg.isEmpty()) {
-        DBGPRINT("%s: error %s", Q_FUNC_INFO, qPrintable(errMsg));
-        agent_.throwScriptError(std::move(errMsg));
-    }
+    runAction(widgetName,
+              QStringLiteral("Can not find widget with such name %1")
+                  .arg(widgetName),
+              [keySeq, modifiers, real_syms](QWidget &w) {
+                  if (!w.hasFocus())
+                      w.setFocus(Qt::ShortcutFocusReason);
+                  DBGPRINT("%s: key(%s) click for widget", Q_FUNC_INFO,
+                           qPrintable(keySeq.toString()));
+                  auto ascii_key
+                      = static_cast<Qt::Key>(keySeq[keySeq.count() - 1]);
+                  QTest::sendKeyEvent(QTest::KeyAction::Click, &w, ascii_key,
+                                      real_syms, modifiers);
+                  DBGPRINT("%s: key(%s) click for widget DONE", Q_FUNC_INFO,
+                           qPrintable(keySeq.toString()));
+                  return QString();
+              });
 }
 
 void ScriptAPI::keyClick(const QString &widgetName, const QString &keyseqStr)
 {
-    Step step(agent_);
+    Step step(agent_, true);
 
     DBGPRINT("%s begin name %s, keys %s", Q_FUNC_INFO, qPrintable(widgetName),
              qPrintable(keyseqStr));
 
-    QWidget *w = getWidgetWithSuchName(agent_, widgetName,
-                                       waitWidgetAppearTimeoutSec_, true);
-
-    if (w == nullptr) {
-        agent_.throwScriptError(
-            QStringLiteral("Can not find widget with such name %1")
-                .arg(widgetName));
-        return;
-    }
-
     const QKeySequence keySeq = QKeySequence::fromString(keyseqStr);
     if (keySeq.isEmpty()) {
         agent_.throwScriptError(
@@ -948,47 +937,35 @@ void ScriptAPI::keyClick(const QString &widgetName, const QString &keyseqStr)
     for (decltype(keySeq.count()) i = 0;
          keySeq.count() > 0 && i < (keySeq.count() - 1); ++i)
         modifiers |= static_cast<Qt::KeyboardModifier>(keySeq[i]);
-    QString errMsg = agent_.runCodeInGuiThreadSyncWithTimeout(
-        [w, keySeq, modifiers] {
-            if (!w->hasFocus())
-                w->setFocus(Qt::ShortcutFocusReason);
-            DBGPRINT("%s: key(%s) click for widget", Q_FUNC_INFO,
-                     qPrintable(keySeq.toString()));
-            QTest::keyClick(w, static_cast<Qt::Key>(keySeq[keySeq.count() - 1]),
-                            modifiers, -1);
-            DBGPRINT("%s: key(%s) click for widget DONE", Q_FUNC_INFO,
-                     qPrintable(keySeq.toString()));
-            return QString();
-        },
-        newEventLoopWaitTimeoutSecs_);
-
-    if (!errMsg.isEmpty()) {
-        DBGPRINT("%s: error %s", Q_FUNC_INFO, qPrintable(errMsg));
-        agent_.throwScriptError(std::move(errMsg));
-    }
+    runAction(widgetName,
+              QStringLiteral("Can not find widget with such name %1")
+                  .arg(widgetName),
+              [keySeq, modifiers](QWidget &w) {
+                  if (!w.hasFocus())
+                      w.setFocus(Qt::ShortcutFocusReason);
+                  DBGPRINT("%s: key(%s) click for widget", Q_FUNC_INFO,
+                           qPrintable(keySeq.toString()));
+                  QTest::keyClick(
+                      &w, static_cast<Qt::Key>(keySeq[keySeq.count() - 1]),
+                      modifiers, -1);
+                  DBGPRINT("%s: key(%s) click for widget DONE", Q_FUNC_INFO,
+                           qPrintable(keySeq.toString()));
+                  return QString();
+              });
 }
 
 void ScriptAPI::chooseWindowWithTitle(const QString &widgetName,
                                       const QString &title)
 {
-    Step step(agent_);
+    Step step(agent_, true);
     DBGPRINT("%s: begin", Q_FUNC_INFO);
-    QWidget *w = getWidgetWithSuchName(agent_, widgetName,
-                                       waitWidgetAppearTimeoutSec_, true);
-
-    if (w == nullptr) {
-        agent_.throwScriptError(
-            QStringLiteral("There is no such widget %1").arg(widgetName));
-        return;
-    }
-    auto workspace = qobject_cast<QWorkspace *>(w);
-    if (workspace == nullptr) {
-        agent_.throwScriptError(
-            QStringLiteral("This is not QWorkspace %1").arg(widgetName));
-        return;
-    }
-    QString errMsg = agent_.runCodeInGuiThreadSyncWithTimeout(
-        [workspace, title] {
+    runAction(
+        widgetName, QStringLiteral("There is no such widget %1").arg(widgetName),
+        [widgetName, title](QWidget &w) {
+            auto workspace = qobject_cast<QWorkspace *>(&w);
+            if (workspace == nullptr)
+                return QStringLiteral("This is not QWorkspace %1")
+                    .arg(widgetName);
             const auto wl = workspace->
 #if QT_VERSION < 0x050000
                             windowList()
@@ -1009,13 +986,7 @@ void ScriptAPI::chooseWindowWithTitle(const QString &widgetName,
                 }
             }
             return QStringLiteral("No window with such title %1").arg(title);
-        },
-        newEventLoopWaitTimeoutSecs_);
-
-    if (!errMsg.isEmpty()) {
-        DBGPRINT("%s: error %s", Q_FUNC_INFO, qPrintable(errMsg));
-        agent_.throwScriptError(std::move(errMsg));
-    }
+        });
 }
 
 void qt_monkey_agent::moveMouseTo(qt_monkey_agent::Agent &agent,
@@ -1051,6 +1022,8 @@ void qt_monkey_agent::moveMouseTo(qt_monkey_agent::Agent &agent,
 void ScriptAPI::setDemonstrationMode(bool val)
 {
     Step step(agent_);
+    if (!syncPipeline())
+        return;
     agent_.setDemonstrationMode(val);
 }
 
@@ -1058,9 +1031,12 @@ void ScriptAPI::pressButtonWithText(const QString &parentNameWidget,
                                     const QString &btnText)
 {
     Step step(agent_);
+    if (!syncPipeline())
+        return;
 
-    QWidget *w = getWidgetWithSuchName(agent_, parentNameWidget,
-                                       waitWidgetAppearTimeoutSec_, true);
+    QWidget *w
+        = getWidgetWithSuchName(agent_, *compiledSelector(parentNameWidget),
+                                waitWidgetAppearTimeoutSec_, true);
     if (w == nullptr) {
         agent_.throwScriptError(
             QStringLiteral("There is no such widget %1").arg(parentNameWidget));
@@ -1101,6 +1077,8 @@ void ScriptAPI::pressButtonWithText(const QString &parentNameWidget,
 void ScriptAPI::Assert(bool condition)
 {
     Step step(agent_);
+    if (!syncPipeline())
+        return;
     if (!condition)
         agent_.throwScriptError(QStringLiteral("Assertion failed"));
 }
@@ -1108,6 +1086,8 @@ void ScriptAPI::Assert(bool condition)
 void ScriptAPI::AssertEqual(const QString &s1, const QString &s2)
 {
     Step step(agent_);
+    if (!syncPipeline())
+        return;
     if (s1 != s2) {
         agent_.throwScriptError(
             QStringLiteral("Assertion failed: Expect \"%1\", Actual \"%2\"")
@@ -1118,8 +1098,10 @@ void ScriptAPI::AssertEqual(const QString &s1, const QString &s2)
 QObject *ScriptAPI::getObjectById(const QString &id)
 {
     Step step(agent_);
-    QWidget *w
-        = getWidgetWithSuchName(agent_, id, waitWidgetAppearTimeoutSec_, false);
+    if (!syncPipeline())
+        return nullptr;
+    QWidget *w = getWidgetWithSuchName(agent_, *compiledSelector(id),
+                                       waitWidgetAppearTimeoutSec_, false);
     if (w == nullptr)
         agent_.throwScriptError(
             QStringLiteral("There is no such widget %1").arg(id));
@@ -1136,12 +1118,16 @@ void ScriptAPI::saveScreenshots(const QString &path, int nSteps)
 {
     DBGPRINT("%s: path '%s'", Q_FUNC_INFO, qPrintable(path));
     Step step(agent_);
+    if (!syncPipeline())
+        return;
     agent_.saveScreenshots(path, nSteps);
 }
 
 void ScriptAPI::quitApp()
 {
     Step step(agent_);
+    if (!syncPipeline())
+        return;
     agent_.runCodeInGuiThreadSync([] {
         QCoreApplication::exit(0);
         return QString();
@@ -1151,6 +1137,8 @@ void ScriptAPI::quitApp()
 QString ScriptAPI::clipboardText() const
 {
     Step step{agent_};
+    if (!syncPipeline())
+        return QString();
     return agent_.runCodeInGuiThreadSync([] {
         auto clipboard = QApplication::clipboard();
         assert(clipboard != nullptr);
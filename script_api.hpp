@@ -1,5 +1,9 @@
 #pragma once
 
+#include <functional>
+#include <memory>
+
+#include <QtCore/QHash>
 #include <QtCore/QObject>
 #include <QtScript/QScriptable>
 
@@ -10,6 +14,10 @@ namespace qt_monkey_agent
 {
 
 class Agent;
+namespace Private
+{
+class WidgetSelector;
+}
 
 void moveMouseTo(Agent &, const QPoint &point);
 void clickInGuiThread(Agent &agent, const QPoint &posA, QWidget &wA,
@@ -17,6 +25,10 @@ void clickInGuiThread(Agent &agent, const QPoint &posA, QWidget &wA,
 QWidget *getWidgetWithSuchName(Agent &agent, const QString &objectName,
                                const int maxTimeToFindWidgetSec,
                                bool shouldBeEnabled);
+QWidget *getWidgetWithSuchName(Agent &agent,
+                               const Private::WidgetSelector &selector,
+                               const int maxTimeToFindWidgetSec,
+                               bool shouldBeEnabled);
 /**
  * public slots of this class are functions
  * that exposed to qt monkey script
@@ -33,7 +45,11 @@ public:
     class Step final
     {
     public:
-        explicit Step(Agent &agent);
+        /**
+         * @param pipelined if true and pipeline mode is on, do not wait
+         * completion of previous actions
+         */
+        explicit Step(Agent &agent, bool pipelined = false);
         ~Step();
     };
     explicit ScriptAPI(Agent &agent, QObject *parent = nullptr);
@@ -167,10 +183,35 @@ public slots:
     //! characters
     QString systemEnvironmentVariable(const QString &name) const noexcept;
 
+    /**
+     * Switch on/off pipeline mode: actions (clicks, key presses and so on)
+     * are executed in background, script waits for them only in sync points:
+     * asserts, reading of GUI state, sync call and at the end of script.
+     * Errors of actions are reported in sync points.
+     */
+    void setPipelineEnabled(bool val);
+    //! wait until all actions started in pipeline mode completed
+    void sync();
+
 private:
     Agent &agent_;
     int waitWidgetAppearTimeoutSec_ = 30;
     int newEventLoopWaitTimeoutSecs_ = 5;
+    //! cache of parsed widget ids, script usually use the same ids many times
+    QHash<QString, std::shared_ptr<const Private::WidgetSelector>> selectors_;
+
+    const std::shared_ptr<const Private::WidgetSelector> &
+    compiledSelector(const QString &id);
+    /**
+     * Find widget and run action with it in GUI thread,
+     * in pipeline mode do not wait action completion
+     * @param action called in GUI thread, should return error message
+     * or empty string
+     */
+    void runAction(const QString &widgetName, QString notFoundMsg,
+                   std::function<QString(QWidget &)> action);
+    //! @return false if error in pipeline was reported to script
+    bool syncPipeline() const;
 
     void doMouseClick(const QString &widgetName, const QString &buttonName,
                       int x, int y, bool doubleClick);
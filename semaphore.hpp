@@ -1,13 +1,27 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <climits>
 #include <condition_variable>
 #include <mutex>
+#include <thread>
+
+#ifdef __linux__
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace qt_monkey_common
 {
 // implement own semaphore, because QSemaphore
-// not annotated for -fsanitize=thread
+// not annotated for -fsanitize=thread.
+// All synchronization goes through std::atomic count (so thread sanitizer
+// sees happens-before relation), futex/condition variable are used only
+// to sleep. Round trip between threads usually is short, so before sleep
+// we spin a little to not pay for context switch.
 class Semaphore final
 {
 public:
@@ -16,30 +30,114 @@ public:
     Semaphore &operator=(const Semaphore &) = delete;
     void acquire(int n = 1)
     {
-        std::unique_lock<std::mutex> lock{mutex_};
-        cv_.wait(lock, [this, n] { return count_ >= n; });
-        count_ -= n;
+        if (spinAcquire(n))
+            return;
+        waiters_.fetch_add(1);
+        while (!tryTake(n))
+            park(n, nullptr);
+        waiters_.fetch_sub(1);
     }
     template <class Rep, class Period>
     bool tryAcquire(int n, const std::chrono::duration<Rep, Period> &d)
     {
-        std::unique_lock<std::mutex> lock{mutex_};
-        const bool finished
-            = cv_.wait_for(lock, d, [this, n] { return count_ >= n; });
-        if (finished)
-            count_ -= n;
+        // caller only polls, so do not spend time on spin
+        if (d <= d.zero())
+            return tryTake(n);
+        if (spinAcquire(n))
+            return true;
+        const auto deadline
+            = std::chrono::steady_clock::now()
+              + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    d);
+        waiters_.fetch_add(1);
+        bool finished = tryTake(n);
+        while (!finished) {
+            const auto now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+                break;
+            const auto left = deadline - now;
+            park(n, &left);
+            finished = tryTake(n);
+        }
+        waiters_.fetch_sub(1);
         return finished;
     }
     void release(int n = 1)
     {
-        std::lock_guard<std::mutex> lock{mutex_};
-        count_ += n;
-        cv_.notify_one();
+        count_.fetch_add(n);
+        if (waiters_.load() > 0)
+            wakeAll();
     }
 
 private:
-    int count_ = 0;
+    static constexpr int spinLimit = 200;
+    std::atomic<int> count_;
+    std::atomic<int> waiters_{0};
+#ifndef __linux__
     std::mutex mutex_;
     std::condition_variable cv_;
+#endif
+
+    bool tryTake(int n)
+    {
+        int cur = count_.load();
+        while (cur >= n)
+            if (count_.compare_exchange_weak(cur, cur - n))
+                return true;
+        return false;
+    }
+    bool spinAcquire(int n)
+    {
+        for (int i = 0; i < spinLimit; ++i) {
+            if (tryTake(n))
+                return true;
+            if (i >= spinLimit / 2)
+                std::this_thread::yield();
+        }
+        return false;
+    }
+    //! sleep until count_ changed or timeout, may return spuriously
+    void park(int n, const std::chrono::steady_clock::duration *timeout)
+    {
+        const int cur = count_.load();
+        if (cur >= n)
+            return;
+#ifdef __linux__
+        static_assert(sizeof(std::atomic<int>) == sizeof(int),
+                      "futex requires plain int layout");
+        struct timespec ts;
+        if (timeout != nullptr) {
+            const auto ns
+                = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      *timeout)
+                      .count();
+            ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+            ts.tv_nsec = static_cast<long>(ns % 1000000000);
+        }
+        // kernel checks that value still the same before sleep,
+        // so release between load and wait is not lost
+        syscall(SYS_futex, reinterpret_cast<int *>(&count_),
+                FUTEX_WAIT_PRIVATE, cur, timeout != nullptr ? &ts : nullptr,
+                nullptr, 0);
+#else
+        std::unique_lock<std::mutex> lock{mutex_};
+        auto changed = [this, cur] { return count_.load() != cur; };
+        if (timeout != nullptr)
+            cv_.wait_for(lock, *timeout, changed);
+        else
+            cv_.wait(lock, changed);
+#endif
+    }
+    void wakeAll()
+    {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<int *>(&count_),
+                FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+        // lock to not lost wakeup between check of predicate and wait
+        std::lock_guard<std::mutex> lock{mutex_};
+        cv_.notify_all();
+#endif
+    }
 };
 } // namespace qt_monkey_common
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <utility>
+
+#include "shared_resource.hpp"
+
+namespace qt_monkey_common
+{
+/**
+ * Lock free ring buffer for one producer thread and one consumer thread
+ * @tparam Capacity should be power of 2
+ */
+template <typename T, size_t Capacity> class SpscRing final
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "Capacity should be power of 2");
+
+public:
+    SpscRing() = default;
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    //! should be called only from producer thread, do not touch @value if full
+    bool tryPush(T &&value)
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == Capacity)
+            return false;
+        buf_[tail & mask] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    //! should be called only from consumer thread
+    bool tryPop(T &value)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+            return false;
+        value = std::move(buf_[head & mask]);
+        buf_[head & mask] = T();
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static constexpr size_t mask = Capacity - 1;
+    static constexpr size_t cacheLineSize = 64;
+    // indexes of consumer and producer should be in different cache lines,
+    // padding used instead of alignas to not require aligned operator new
+    std::atomic<size_t> head_{0};
+    char headPadding_[cacheLineSize - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail_{0};
+    char tailPadding_[cacheLineSize - sizeof(std::atomic<size_t>)];
+    T buf_[Capacity];
+};
+
+/**
+ * Queue for one producer thread and one consumer thread, in usual case
+ * it do not use locks, but if consumer is busy and ring is full
+ * values go to overflow list, so producer never blocks.
+ * Order of values is preserved.
+ */
+template <typename T, size_t Capacity> class SpscQueue final
+{
+public:
+    SpscQueue() = default;
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    /**
+     * Should be called only from producer thread
+     * @return true if consumer should be woken up, it is true only
+     * for first value after consumeAll
+     */
+    bool push(T value)
+    {
+        if (overflowUsed_.load(std::memory_order_acquire)
+            || !ring_.tryPush(std::move(value))) {
+            auto overflow = overflow_.get();
+            overflow->push_back(std::move(value));
+            overflowUsed_.store(true, std::memory_order_release);
+        }
+        return !wakeupPending_.exchange(true, std::memory_order_acq_rel);
+    }
+    //! Should be called only from consumer thread
+    template <typename Func> void consumeAll(Func &&func)
+    {
+        wakeupPending_.exchange(false, std::memory_order_acq_rel);
+        T value;
+        while (ring_.tryPop(value))
+            func(std::move(value));
+        if (!overflowUsed_.load(std::memory_order_acquire))
+            return;
+        // producer do not use ring while overflow is not empty,
+        // so all values in ring are older than values in overflow
+        while (ring_.tryPop(value))
+            func(std::move(value));
+        std::deque<T> overflow;
+        {
+            auto lock = overflow_.get();
+            overflow.swap(*lock);
+            overflowUsed_.store(false, std::memory_order_release);
+        }
+        for (T &v : overflow)
+            func(std::move(v));
+        // values pushed after overflow was taken
+        while (ring_.tryPop(value))
+            func(std::move(value));
+    }
+
+private:
+    SpscRing<T, Capacity> ring_;
+    std::atomic<bool> overflowUsed_{false};
+    std::atomic<bool> wakeupPending_{false};
+    SharedResource<std::deque<T>> overflow_;
+};
+} // namespace qt_monkey_common
@@ -0,0 +1,68 @@
+#include "suite_history.hpp"
+
+#include <algorithm>
+#include <string>
+
+#include <QtCore/QFile>
+
+#include "common.hpp"
+#include "json11.hpp"
+
+using json11::Json;
+using qt_monkey_app::SuiteHistory;
+
+bool SuiteHistory::load(const QString &path, QString &errMsg)
+{
+    QFile f(path);
+    if (!f.exists())
+        return true;
+    if (!f.open(QIODevice::ReadOnly)) {
+        errMsg = T_("Can not open %1: %2").arg(path).arg(f.errorString());
+        return false;
+    }
+    const QByteArray data = f.readAll();
+    std::string err;
+    const Json json
+        = Json::parse(std::string(data.constData(),
+                                  static_cast<size_t>(data.size())),
+                      err);
+    if (!json.is_object()) {
+        errMsg = T_("Can not parse %1: %2")
+                     .arg(path)
+                     .arg(QString::fromUtf8(err.c_str()));
+        return false;
+    }
+    for (const auto &item : json.object_items())
+        if (item.second.is_number())
+            durations_[QString::fromUtf8(item.first.c_str())]
+                = item.second.number_value();
+    return true;
+}
+
+bool SuiteHistory::save(const QString &path, QString &errMsg) const
+{
+    Json::object obj;
+    for (auto it = durations_.begin(); it != durations_.end(); ++it)
+        obj[it.key().toUtf8().constData()] = it.value();
+    const std::string data = Json(obj).dump();
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)
+        || f.write(data.data(), static_cast<qint64>(data.size()))
+               != static_cast<qint64>(data.size())) {
+        errMsg = T_("Can not write %1: %2").arg(path).arg(f.errorString());
+        return false;
+    }
+    return true;
+}
+
+QStringList SuiteHistory::longestFirst(QStringList scripts) const
+{
+    std::stable_sort(scripts.begin(), scripts.end(),
+                     [this](const QString &a, const QString &b) {
+                         const double durA = duration(a), durB = duration(b);
+                         if ((durA < 0) != (durB < 0))
+                             return durA < 0;
+                         return durA > durB;
+                     });
+    return scripts;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+namespace qt_monkey_app
+{
+/**
+ * Durations of scripts in previous runs of suite,
+ * stored as json object: {"path/to/script.js": seconds, ...}
+ */
+class SuiteHistory final
+{
+public:
+    //! not existing file is not error, it is empty history
+    bool load(const QString &path, QString &errMsg);
+    bool save(const QString &path, QString &errMsg) const;
+    void setDuration(const QString &script, double seconds)
+    {
+        durations_[script] = seconds;
+    }
+    //! @return negative value if there is no history for script
+    double duration(const QString &script) const
+    {
+        return durations_.value(script, -1.);
+    }
+    /**
+     * Order scripts for scheduling: longest first, so the last
+     * scripts of suite are short and workers finish at the same time.
+     * Scripts without history go first, because of they may be long.
+     */
+    QStringList longestFirst(QStringList scripts) const;
+
+private:
+    QHash<QString, double> durations_;
+};
+} // namespace qt_monkey_app
@@ -0,0 +1,353 @@
+//#define DEBUG_SUITE_RUNNER
+#include "suite_runner.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
+
+#include "common.hpp"
+#include "json11.hpp"
+
+#ifdef DEBUG_SUITE_RUNNER
+#define DBGPRINT(fmt, ...) qDebug(fmt, __VA_ARGS__)
+#else
+#define DBGPRINT(fmt, ...)                                                     \
+    do {                                                                       \
+    } while (false)
+#endif
+
+using json11::Json;
+using qt_monkey_app::SuiteRunner;
+
+namespace
+{
+static constexpr int waitDisplayMs = 10000;
+static constexpr int waitStepMs = 50;
+
+static inline std::ostream &operator<<(std::ostream &os, const QString &str)
+{
+    os << str.toLocal8Bit();
+    return os;
+}
+} // namespace
+
+SuiteRunner::SuiteRunner(Options opts) : opts_(std::move(opts))
+{
+    assert(opts_.jobs > 0);
+}
+
+SuiteRunner::~SuiteRunner()
+{
+    for (auto &worker : workers_) {
+        if (worker->monkey.state() != QProcess::NotRunning) {
+            worker->monkey.kill();
+            worker->monkey.waitForFinished(1000 /*ms*/);
+        }
+        if (worker->xvfb && worker->xvfb->state() != QProcess::NotRunning) {
+            worker->xvfb->terminate();
+            if (!worker->xvfb->waitForFinished(1000 /*ms*/)) {
+                worker->xvfb->kill();
+                worker->xvfb->waitForFinished(1000 /*ms*/);
+            }
+        }
+    }
+}
+
+bool SuiteRunner::start(const QStringList &scripts)
+{
+    QString errMsg;
+    if (!opts_.historyPath.isEmpty()
+        && !history_.load(opts_.historyPath, errMsg)) {
+        // do not overwrite history, that may be fixed by hand
+        saveHistory_ = false;
+        std::cerr << T_("Warning: %1, all scripts are considered long, "
+                        "durations will not be saved\n")
+                         .arg(errMsg);
+    }
+    for (const QString &script : history_.longestFirst(scripts))
+        toRun_.push_back(script);
+
+    const int nWorkers = std::min(opts_.jobs, scripts.size());
+    for (int i = 0; i < nWorkers; ++i) {
+        std::unique_ptr<Worker> worker{new Worker};
+        worker->index = i;
+        connect(&worker->monkey, SIGNAL(finished(int, QProcess::ExitStatus)),
+                this, SLOT(workerFinished(int, QProcess::ExitStatus)));
+        connect(&worker->monkey, SIGNAL(error(QProcess::ProcessError)), this,
+                SLOT(workerError(QProcess::ProcessError)));
+        connect(&worker->monkey, SIGNAL(readyReadStandardOutput()), this,
+                SLOT(workerOutput()));
+        connect(&worker->monkey, SIGNAL(readyReadStandardError()), this,
+                SLOT(workerErrOutput()));
+        workers_.push_back(std::move(worker));
+    }
+    if (opts_.display == Display::Xvfb && !startDisplays())
+        return false;
+    for (auto &worker : workers_) {
+        QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+        if (opts_.display == Display::Xvfb)
+            env.insert(QStringLiteral("DISPLAY"), worker->display);
+        else if (opts_.display == Display::Offscreen)
+            env.insert(QStringLiteral("QT_QPA_PLATFORM"),
+                       QStringLiteral("offscreen"));
+        worker->monkey.setProcessEnvironment(env);
+    }
+    suiteStartTime_ = std::chrono::steady_clock::now();
+    if (workers_.empty()) {
+        // event loop is not started yet, so exit later
+        QMetaObject::invokeMethod(this, "finish", Qt::QueuedConnection);
+        return true;
+    }
+    for (auto &worker : workers_)
+        runNext(*worker);
+    return true;
+}
+
+bool SuiteRunner::startDisplays()
+{
+    for (auto &worker : workers_) {
+        worker->xvfb.reset(new QProcess);
+        // Xvfb chooses free display itself and writes its number
+        // to stdout, when it is ready to accept connections, so there is
+        // no race with other servers and no stale sockets or lock files
+        worker->xvfb->start(QStringLiteral("Xvfb"),
+                            QStringList() << "-displayfd"
+                                          << "1"
+                                          << "-screen"
+                                          << "0"
+                                          << "1280x1024x24"
+                                          << "-nolisten"
+                                          << "tcp");
+        if (!worker->xvfb->waitForStarted()) {
+            std::cerr << T_("Can not start Xvfb for worker %1: %2\n")
+                             .arg(worker->index)
+                             .arg(worker->xvfb->errorString());
+            return false;
+        }
+    }
+    // servers start in parallel, wait until all of them report display
+    for (int waitMs = 0;; waitMs += waitStepMs) {
+        bool allReady = true;
+        for (auto &worker : workers_) {
+            if (worker->display.isEmpty() && worker->xvfb->canReadLine()) {
+                const QString no
+                    = QString::fromLatin1(worker->xvfb->readLine()).trimmed();
+                worker->display = QStringLiteral(":%1").arg(no);
+                DBGPRINT("%s: worker %d uses display %s", Q_FUNC_INFO,
+                         worker->index, qPrintable(worker->display));
+            }
+            if (worker->display.isEmpty()
+                && worker->xvfb->state() == QProcess::NotRunning) {
+                std::cerr << T_("Xvfb for worker %1 exited\n")
+                                 .arg(worker->index);
+                return false;
+            }
+            allReady = allReady && !worker->display.isEmpty();
+        }
+        if (allReady)
+            return true;
+        if (waitMs >= waitDisplayMs) {
+            std::cerr << T_("Xvfb not ready after %1 ms\n").arg(waitDisplayMs);
+            return false;
+        }
+        qt_monkey_common::processEventsFor(waitStepMs);
+    }
+}
+
+SuiteRunner::Worker *SuiteRunner::findWorker(QObject *monkey)
+{
+    for (auto &worker : workers_)
+        if (&worker->monkey == monkey)
+            return worker.get();
+    return nullptr;
+}
+
+void SuiteRunner::runNext(Worker &worker)
+{
+    if (toRun_.empty()) {
+        worker.busy = false;
+        if (std::none_of(workers_.begin(), workers_.end(),
+                         [](const std::unique_ptr<Worker> &w) {
+                             return w->busy;
+                         }))
+            // worker may fail to start before event loop
+            QMetaObject::invokeMethod(this, "finish", Qt::QueuedConnection);
+        return;
+    }
+    worker.busy = true;
+    worker.script = std::move(toRun_.front());
+    toRun_.pop_front();
+    worker.framer = JsonLineFramer();
+    worker.errors.clear();
+    worker.log.clear();
+    worker.startTime = std::chrono::steady_clock::now();
+    DBGPRINT("%s: worker %d runs %s", Q_FUNC_INFO, worker.index,
+             qPrintable(worker.script));
+    worker.monkey.start(QCoreApplication::applicationFilePath(),
+                        QStringList(opts_.monkeyArgs)
+                            << "--exit-on-script-error"
+                            << "--script" << worker.script << "--user-app"
+                            << opts_.userAppPath << opts_.userAppArgs);
+    // child not needs commands from gui
+    worker.monkey.closeWriteChannel();
+}
+
+void SuiteRunner::workerFinished(int exitCode, QProcess::ExitStatus exitStatus)
+{
+    Worker *worker = findWorker(sender());
+    assert(worker != nullptr);
+    if (worker == nullptr || !worker->busy)
+        return;
+    readOutput(*worker);
+    readErrOutput(*worker);
+    if (exitStatus != QProcess::NormalExit)
+        scriptDone(*worker, false, T_("qtmonkey_app crashed"));
+    else if (exitCode != EXIT_SUCCESS)
+        scriptDone(*worker, false,
+                   T_("qtmonkey_app exit status %1").arg(exitCode));
+    else
+        scriptDone(*worker, true, QString());
+    runNext(*worker);
+}
+
+void SuiteRunner::workerError(QProcess::ProcessError err)
+{
+    // in other cases finished is emitted
+    if (err != QProcess::FailedToStart)
+        return;
+    Worker *worker = findWorker(sender());
+    assert(worker != nullptr);
+    if (worker == nullptr || !worker->busy)
+        return;
+    scriptDone(*worker, false, qt_monkey_common::processErrorToString(err));
+    runNext(*worker);
+}
+
+void SuiteRunner::workerOutput()
+{
+    Worker *worker = findWorker(sender());
+    assert(worker != nullptr);
+    if (worker != nullptr)
+        readOutput(*worker);
+}
+
+void SuiteRunner::workerErrOutput()
+{
+    Worker *worker = findWorker(sender());
+    assert(worker != nullptr);
+    if (worker != nullptr)
+        readErrOutput(*worker);
+}
+
+void SuiteRunner::readOutput(Worker &worker)
+{
+    const QByteArray data = worker.monkey.readAllStandardOutput();
+    worker.framer.feed(
+        data.constData(), static_cast<size_t>(data.size()),
+        [&worker](const char *msg, size_t len) {
+            // stderr of application is usual logging, not reason of failure
+            parseLineFromMonkeyApp(
+                msg, len, [](QString) {},
+                [&worker](QString errOut) { worker.log += errOut; },
+                [&worker](QString errMsg) { worker.errors += errMsg; },
+                []() {}, [&worker](QString logMsg) { worker.log += logMsg; },
+                [&worker](QString errMsg) {
+                    worker.errors
+                        += T_("Can not parse gui<->monkey protocol: %1\n")
+                               .arg(errMsg);
+                });
+        });
+}
+
+void SuiteRunner::readErrOutput(Worker &worker)
+{
+    worker.log += QString::fromLocal8Bit(worker.monkey.readAllStandardError());
+}
+
+void SuiteRunner::scriptDone(Worker &worker, bool passed,
+                             const QString &reason)
+{
+    const double seconds
+        = std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - worker.startTime)
+              .count()
+          / 1000.;
+    // failed script may stop at the beginning, so its time is not typical
+    if (passed)
+        history_.setDuration(worker.script, seconds);
+    QString errors = reason;
+    if (!errors.isEmpty() && !worker.errors.isEmpty())
+        errors += QLatin1Char('\n');
+    errors += worker.errors;
+    Result res{worker.script, worker.index, passed, seconds, errors,
+               worker.log};
+    std::cout << (passed ? "PASSED " : "FAILED ") << res.script << " ("
+              << seconds << " s, worker " << worker.index << ")\n";
+    if (!passed)
+        std::cout << res.errors << "\n";
+    std::cout.flush();
+    results_.push_back(std::move(res));
+}
+
+void SuiteRunner::finish()
+{
+    QString errMsg;
+    if (saveHistory_ && !opts_.historyPath.isEmpty()
+        && !history_.save(opts_.historyPath, errMsg))
+        std::cerr << T_("Warning: %1\n").arg(errMsg);
+    if (!opts_.reportPath.isEmpty())
+        writeReport();
+    const auto nFailed = std::count_if(
+        results_.begin(), results_.end(),
+        [](const Result &res) { return !res.passed; });
+    std::cout << T_("%1 scripts passed, %2 failed\n")
+                     .arg(static_cast<int>(results_.size() - nFailed))
+                     .arg(static_cast<int>(nFailed));
+    std::cout.flush();
+    QCoreApplication::exit(nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+void SuiteRunner::writeReport()
+{
+    Json::array scripts;
+    size_t nPassed = 0;
+    for (const Result &res : results_) {
+        if (res.passed)
+            ++nPassed;
+        scripts.push_back(Json::object{
+            {"script", res.script.toUtf8().constData()},
+            {"worker", res.worker},
+            {"passed", res.passed},
+            {"seconds", res.seconds},
+            {"errors", res.errors.toUtf8().constData()},
+            {"log", res.log.toUtf8().constData()},
+        });
+    }
+    const double seconds
+        = std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - suiteStartTime_)
+              .count()
+          / 1000.;
+    const std::string data
+        = Json(Json::object{
+                   {"jobs", opts_.jobs},
+                   {"seconds", seconds},
+                   {"passed", static_cast<int>(nPassed)},
+                   {"failed", static_cast<int>(results_.size() - nPassed)},
+                   {"scripts", scripts},
+               })
+              .dump();
+    QFile f(opts_.reportPath);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)
+        || f.write(data.data(), static_cast<qint64>(data.size()))
+               != static_cast<qint64>(data.size()))
+        std::cerr << T_("Can not write report to %1: %2\n")
+                         .arg(opts_.reportPath)
+                         .arg(f.errorString());
+}
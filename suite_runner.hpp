@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <QtCore/QObject>
+#include <QtCore/QProcess>
+#include <QtCore/QStringList>
+
+#include "qtmonkey_app_api.hpp"
+#include "suite_history.hpp"
+
+namespace qt_monkey_app
+{
+/**
+ * Run suite of scripts by several workers in parallel.
+ * Worker is child qtmonkey_app with own instance of user app
+ * (and so own port or socket for agent) and own display.
+ * Every script runs in new instance of user app.
+ */
+class SuiteRunner
+#ifndef Q_MOC_RUN
+    final
+#endif
+    : public QObject
+{
+    Q_OBJECT
+public:
+    enum class Display {
+        //! use display of qtmonkey_app
+        Inherit,
+        //! start Xvfb for every worker, default on X11 platforms
+        Xvfb,
+        //! QT_QPA_PLATFORM=offscreen, Qt 5 only
+        Offscreen,
+    };
+    struct Options final {
+        int jobs = 1;
+#if defined(Q_OS_UNIX) && !defined(Q_OS_MAC)
+        Display display = Display::Xvfb;
+#else
+        Display display = Display::Inherit;
+#endif
+        QString userAppPath;
+        QStringList userAppArgs;
+        //! passed to every child qtmonkey_app
+        QStringList monkeyArgs;
+        //! file with durations of scripts from previous runs
+        QString historyPath;
+        //! where to write json report, nothing written if empty
+        QString reportPath;
+    };
+
+    explicit SuiteRunner(Options opts);
+    ~SuiteRunner();
+    /**
+     * Start workers, QCoreApplication::exit is called
+     * when all scripts are done
+     * @return false if workers can not be started
+     */
+    bool start(const QStringList &scripts);
+private slots:
+    void workerFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    void workerError(QProcess::ProcessError err);
+    void workerOutput();
+    void workerErrOutput();
+    void finish();
+
+private:
+    struct Result final {
+        QString script;
+        int worker;
+        bool passed;
+        double seconds;
+        //! errors reported by child qtmonkey_app
+        QString errors;
+        QString log;
+    };
+    struct Worker final {
+        int index;
+        QProcess monkey;
+        std::unique_ptr<QProcess> xvfb;
+        //! empty until Xvfb reports that it is ready
+        QString display;
+        bool busy = false;
+        QString script;
+        std::chrono::steady_clock::time_point startTime;
+        JsonLineFramer framer;
+        QString errors;
+        QString log;
+    };
+
+    const Options opts_;
+    SuiteHistory history_;
+    //! false if history exists, but can not be loaded
+    bool saveHistory_ = true;
+    std::deque<QString> toRun_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<Result> results_;
+    std::chrono::steady_clock::time_point suiteStartTime_;
+
+    bool startDisplays();
+    Worker *findWorker(QObject *monkey);
+    void readOutput(Worker &worker);
+    void readErrOutput(Worker &worker);
+    void runNext(Worker &worker);
+    void scriptDone(Worker &worker, bool passed, const QString &reason);
+    void writeReport();
+};
+} // namespace qt_monkey_app
@@ -14,7 +14,7 @@ myCustomButtonAnalyzer(const qt_monkey_agent::EventInfo &eventInfo)
     if (eventInfo.widget == nullptr
         || eventInfo.event->type() != QEvent::MouseButtonPress)
         return res;
-    auto btn = qobject_cast<MyCustomButton *>(eventInfo.widget);
+    auto btn = qobject_cast<MyCustomButton *>(eventInfo.matchedWidget);
     if (btn == nullptr)
         return res;
     qDebug("%s: it is our custom button", Q_FUNC_INFO);
@@ -26,7 +26,10 @@ int main(int argc, char *argv[])
     QApplication app(argc, argv);
     ScriptExt scriptExt;
     qt_monkey_agent::Agent agent(
-        QKeySequence(Qt::Key_F12 | Qt::SHIFT), {myCustomButtonAnalyzer},
+        QKeySequence(Qt::Key_F12 | Qt::SHIFT),
+        {qt_monkey_agent::CustomEventAnalyzer(
+            myCustomButtonAnalyzer, {QEvent::MouseButtonPress},
+            "MyCustomButton", 1)},
         [&scriptExt](QScriptEngine &engine) {
             QScriptValue global = engine.globalObject();
             QScriptValue ext_api_js_obj = engine.newQObject(&scriptExt);
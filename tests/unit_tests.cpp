@@ -1,9 +1,15 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <functional>
 #include <iostream>
 #include <thread>
+#include <vector>
 
 #include <QApplication>
+#include <QtCore/QBuffer>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
 #include <QtCore/QEventLoop>
 #include <QtCore/QThread>
 #include <QtTest/QSignalSpy>
@@ -13,8 +19,13 @@
 #include "agent_qtmonkey_communication.hpp"
 #include "common.hpp"
 #include "json11.hpp"
+#include "output_batcher.hpp"
 #include "qtmonkey_app_api.hpp"
 #include "script.hpp"
+#include "semaphore.hpp"
+#include "spsc_queue.hpp"
+#include "suite_history.hpp"
+#include "widget_selector.hpp"
 
 using qt_monkey_common::operator<<;
 
@@ -55,10 +66,12 @@ TEST(QtMonkey, CommunicationBasic)
     CommunicationMonkeyPart server;
     const auto env = server.requiredProcessEnvironment();
     ASSERT_TRUE(qputenv(env.first.toUtf8().data(), env.second.toUtf8()));
-    QSignalSpy serverSpy(&server, SIGNAL(newUserAppEvent(QString)));
+    QSignalSpy serverSpy(&server, SIGNAL(newUserAppEvent(int, QString)));
     ASSERT_TRUE(serverSpy.isValid());
     QSignalSpy serverErr(&server, SIGNAL(error(const QString &)));
     ASSERT_TRUE(serverErr.isValid());
+    QSignalSpy serverDisconnect(&server, SIGNAL(agentDisconnected(int)));
+    ASSERT_TRUE(serverDisconnect.isValid());
 
     class ClientThread final : public QThread
     {
@@ -74,6 +87,9 @@ TEST(QtMonkey, CommunicationBasic)
                 loop.processEvents(QEventLoop::AllEvents, milliseconds);
             };
             processEventsForSomeTime(procFunc, std::chrono::milliseconds(200));
+            // hello already sent and answered
+            EXPECT_TRUE(client.monkeyHasCapability(Capability::ScriptQueue));
+            const auto statsBefore = client.sendStats();
             client.sendCommand(PacketTypeForMonkey::NewUserAppEvent,
                                "Test.log(\"hi\");");
             client.sendCommand(PacketTypeForMonkey::NewUserAppEvent,
@@ -82,6 +98,9 @@ TEST(QtMonkey, CommunicationBasic)
             client.sendCommand(PacketTypeForMonkey::ScriptEnd, QString());
             processEventsForSomeTime(procFunc, std::chrono::milliseconds(200));
             ASSERT_EQ(0, clientErr.count());
+            // all packets queued before wakeup should be sent by one write
+            EXPECT_EQ(4u, client.sendStats().packets - statsBefore.packets);
+            EXPECT_EQ(1u, client.sendStats().writes - statsBefore.writes);
         }
     } clientThread;
     clientThread.start();
@@ -95,8 +114,184 @@ TEST(QtMonkey, CommunicationBasic)
     ASSERT_EQ(2, serverSpy.count());
     QList<QVariant> userAppEventArgs
         = serverSpy.takeFirst(); // take the first signal
-    EXPECT_EQ(QString("Test.log(\"hi\");"), userAppEventArgs.at(0).toString());
+    const int sessionId = userAppEventArgs.at(0).toInt();
+    EXPECT_EQ(QString("Test.log(\"hi\");"), userAppEventArgs.at(1).toString());
     clientThread.wait(3000 /*milliseconds*/);
+    processEventsForSomeTime(
+        [](int milliseconds) {
+            qApp->processEvents(QEventLoop::AllEvents, milliseconds);
+        },
+        std::chrono::milliseconds(100));
+    ASSERT_EQ(1, serverDisconnect.count());
+    EXPECT_EQ(sessionId, serverDisconnect.takeFirst().at(0).toInt());
+    EXPECT_EQ(CommunicationMonkeyPart::invalidSession,
+              server.findSession(QString()));
+}
+
+#if QT_VERSION >= 0x050000
+TEST(QtMonkey, CommunicationScriptArrivesDuringScript)
+{
+    using namespace qt_monkey_agent::Private;
+
+    CommunicationMonkeyPart server;
+    const auto env = server.requiredProcessEnvironment();
+    ASSERT_TRUE(qputenv(env.first.toUtf8().data(), env.second.toUtf8()));
+    QSignalSpy serverReady(&server, SIGNAL(agentReadyToRunScript()));
+    ASSERT_TRUE(serverReady.isValid());
+    QSignalSpy serverLog(&server, SIGNAL(scriptLog(int, QString)));
+    ASSERT_TRUE(serverLog.isValid());
+
+    class ClientThread final : public QThread
+    {
+    public:
+        std::vector<QString> scripts;
+
+        void run() override
+        {
+            CommunicationAgentPart client;
+            QEventLoop loop;
+            auto procFunc = [&loop](int milliseconds) {
+                loop.processEvents(QEventLoop::AllEvents, milliseconds);
+            };
+            // like agent: script runs inside of readyRead handler
+            // and processes events while runs
+            QObject::connect(
+                &client, &CommunicationAgentPart::runScript, &client,
+                [this, &client, &procFunc](const Script &script, bool) {
+                    scripts.push_back(script.code());
+                    if (scripts.size() != 1)
+                        return;
+                    client.sendCommand(PacketTypeForMonkey::ScriptLog,
+                                       "started");
+                    processEventsForSomeTime(procFunc,
+                                             std::chrono::milliseconds(500));
+                },
+                Qt::DirectConnection);
+            ASSERT_TRUE(client.connectToMonkey());
+            processEventsForSomeTime(procFunc, std::chrono::milliseconds(1500));
+        }
+    } clientThread;
+    clientThread.start();
+
+    auto processEventsUntil = [](std::function<bool()> cond) {
+        const auto start = std::chrono::steady_clock::now();
+        while (!cond()
+               && std::chrono::steady_clock::now() - start
+                      < std::chrono::seconds(2))
+            qApp->processEvents(QEventLoop::AllEvents, 10);
+    };
+    processEventsUntil([&serverReady] { return serverReady.count() > 0; });
+    const int sessionId = server.findSession(QString());
+    ASSERT_NE(CommunicationMonkeyPart::invalidSession, sessionId);
+    server.sendCommand(sessionId, PacketTypeForAgent::RunQueuedScript,
+                       "first");
+    // the second script is sent only when the first one is running
+    processEventsUntil([&serverLog] { return serverLog.count() > 0; });
+    ASSERT_EQ(1, serverLog.count());
+    server.sendCommand(sessionId, PacketTypeForAgent::RunScript, "second");
+    processEventsUntil([&clientThread] { return clientThread.isFinished(); });
+    ASSERT_TRUE(clientThread.wait(3000 /*milliseconds*/));
+    ASSERT_EQ(2u, clientThread.scripts.size());
+    EXPECT_EQ(QString("first"), clientThread.scripts[0]);
+    EXPECT_EQ(QString("second"), clientThread.scripts[1]);
+}
+#endif
+
+TEST(QtMonkey, PacketReader)
+{
+    using qt_monkey_agent::Private::PacketReader;
+    auto packet = [](uint32_t type, const QString &text) {
+        const QByteArray data = text.toUtf8();
+        const uint32_t header[]
+            = {0x12345678u, type, static_cast<uint32_t>(data.size())};
+        return QByteArray(reinterpret_cast<const char *>(header),
+                          sizeof(header))
+               + data;
+    };
+    auto packetText = [](int i) -> QString {
+        // not only ASCII, to check decoding of utf-8
+        return QStringLiteral("Test.log(\"%1\");").arg(i) + QChar(0x0444);
+    };
+    const int nPackets = 1000;
+    QByteArray stream;
+    for (int i = 0; i < nPackets; ++i)
+        stream += packet(static_cast<uint32_t>(i % 7), packetText(i));
+
+    PacketReader reader;
+    // feed data in pieces that do not match boundaries of packets
+    QBuffer dev(&stream);
+    ASSERT_TRUE(dev.open(QIODevice::ReadOnly));
+    int nTaken = 0;
+    while (dev.bytesAvailable() > 0) {
+        ASSERT_GT(reader.readFrom(dev, std::min<qint64>(dev.bytesAvailable(),
+                                                        37 + nTaken % 500)),
+                  0);
+        while (reader.state() == PacketReader::State::Ready) {
+            const auto res = reader.take();
+            EXPECT_EQ(static_cast<uint32_t>(nTaken % 7), res.first);
+            EXPECT_EQ(packetText(nTaken), res.second);
+            ++nTaken;
+        }
+        ASSERT_EQ(PacketReader::State::NotReady, reader.state());
+    }
+    EXPECT_EQ(nPackets, nTaken);
+    EXPECT_TRUE(reader.isEmpty());
+
+    const QByteArray garbage("garbage!garbage!");
+    reader.append(garbage.constData(), garbage.size());
+    EXPECT_EQ(PacketReader::State::Damaged, reader.state());
+}
+
+TEST(QtMonkey, PacketReaderFragments)
+{
+    using qt_monkey_agent::Private::PacketReader;
+    using qt_monkey_agent::Private::packetTypeContinuation;
+    auto packet = [](uint32_t type, const QByteArray &data) {
+        const uint32_t header[]
+            = {0x12345678u, type, static_cast<uint32_t>(data.size())};
+        return QByteArray(reinterpret_cast<const char *>(header),
+                          sizeof(header))
+               + data;
+    };
+    QString bigText;
+    for (int i = 0; bigText.size() < 3 * 1024 * 1024; ++i)
+        bigText += QStringLiteral("Test.log(\"%1\");").arg(i) + QChar(0x0444);
+    const QByteArray utf8 = bigText.toUtf8();
+    const uint32_t msgType = 3;
+    QByteArray stream;
+    // fragments split utf-8 sequences, so decoding should be stateful
+    const int fragmentSize = 1001;
+    for (int pos = 0; pos < utf8.size(); pos += fragmentSize) {
+        const bool last = pos + fragmentSize >= utf8.size();
+        stream += packet(last ? msgType : (msgType | packetTypeContinuation),
+                         utf8.mid(pos, fragmentSize));
+    }
+    stream += packet(1, QByteArray("after"));
+
+    PacketReader reader;
+    QBuffer dev(&stream);
+    ASSERT_TRUE(dev.open(QIODevice::ReadOnly));
+    std::vector<std::pair<uint32_t, QString>> messages;
+    while (dev.bytesAvailable() > 0) {
+        ASSERT_GT(reader.readFrom(dev, std::min<qint64>(dev.bytesAvailable(),
+                                                        64 * 1024)),
+                  0);
+        while (reader.state() == PacketReader::State::Ready)
+            messages.push_back(reader.take());
+        ASSERT_EQ(PacketReader::State::NotReady, reader.state());
+    }
+    ASSERT_EQ(2u, messages.size());
+    EXPECT_EQ(msgType, messages[0].first);
+    EXPECT_TRUE(bigText == messages[0].second);
+    EXPECT_EQ(1u, messages[1].first);
+    EXPECT_EQ(QString("after"), messages[1].second);
+
+    // fragments of one message should have the same type
+    const QByteArray mixed
+        = packet(2 | packetTypeContinuation, QByteArray("a"))
+          + packet(1, QByteArray("b"));
+    reader.append(mixed.constData(), mixed.size());
+    EXPECT_EQ(PacketReader::State::Damaged, reader.state());
 }
 
 TEST(QtMonkey, app_api)
@@ -104,14 +299,19 @@ TEST(QtMonkey, app_api)
     using namespace qt_monkey_app;
     QString script = "Test.log(\"something\");\nTest.log(\"other\");";
     std::string data = createPacketFromUserAppEvent(script);
+    // event from other process is tagged by its name
+    data.append(createPacketFromUserAppEvent(script, "worker"));
     QString errOut = "Bad things happen";
     data.append(createPacketFromUserAppErrors(errOut));
+    QString scriptErr = "Script failed";
+    data.append(createPacketFromScriptError(scriptErr));
     data.append(createPacketFromScriptEnd());
     QString logMsg = "Hi!";
     data.append(createPacketFromUserAppScriptLog(logMsg));
 
     size_t pos;
-    size_t eventsCnt = 0, errMsgsCnt = 0, endCnt = 0, logCnt = 0;
+    size_t eventsCnt = 0, errMsgsCnt = 0, scriptErrCnt = 0, endCnt = 0,
+           logCnt = 0;
     size_t errs = 0;
     parseOutputFromMonkeyApp(data, pos,
                              [&script, &eventsCnt](QString data) {
@@ -122,6 +322,10 @@ TEST(QtMonkey, app_api)
                                  ++errMsgsCnt;
                                  EXPECT_EQ(errOut, data);
                              },
+                             [&scriptErr, &scriptErrCnt](QString data) {
+                                 ++scriptErrCnt;
+                                 EXPECT_EQ(scriptErr, data);
+                             },
                              [&endCnt]() { // on script end
                                  ++endCnt;
                              },
@@ -134,8 +338,9 @@ TEST(QtMonkey, app_api)
                                           qPrintable(data));
                                  ++errs;
                              });
-    EXPECT_EQ(1u, eventsCnt);
+    EXPECT_EQ(2u, eventsCnt);
     EXPECT_EQ(1u, errMsgsCnt);
+    EXPECT_EQ(1u, scriptErrCnt);
     EXPECT_EQ(1u, endCnt);
     EXPECT_EQ(1u, logCnt);
     EXPECT_EQ(0u, errs);
@@ -162,6 +367,259 @@ TEST(QtMonkey, app_api)
     EXPECT_EQ(static_cast<size_t>(data.size()), pos);
 }
 
+TEST(QtMonkey, PacketWriter)
+{
+    using namespace qt_monkey_app;
+    QString tricky = QString("\"quote\" \\ \t\r\n") + QChar(0x1)
+                     + QChar(0x0444) + QChar(0x2028);
+    tricky += QChar(0xD83D);
+    tricky += QChar(0xDE00); // surrogate pair
+    std::string buf;
+    PacketWriter writer{buf};
+    for (int i = 0; i < 3; ++i) {
+        writer.userAppEvent(tricky);
+        buf += '\n';
+        writer.scriptLog(tricky);
+        buf += '\n';
+    }
+    size_t pos = 0, events = 0, logs = 0;
+    parseOutputFromMonkeyApp(
+        buf, pos,
+        [&](QString data) {
+            ++events;
+            EXPECT_EQ(tricky, data);
+        },
+        [](QString) { ADD_FAILURE(); }, [](QString) { ADD_FAILURE(); },
+        []() { ADD_FAILURE(); },
+        [&](QString data) {
+            ++logs;
+            EXPECT_EQ(tricky, data);
+        },
+        [](QString) { ADD_FAILURE(); });
+    EXPECT_EQ(3u, events);
+    EXPECT_EQ(3u, logs);
+}
+
+TEST(QtMonkey, JsonLineFramer)
+{
+    using namespace qt_monkey_app;
+    std::vector<std::string> sent;
+    std::string stream;
+    for (int i = 0; i < 100; ++i) {
+        sent.push_back(createPacketFromRunScript(
+            QString("Test.log(\"%1\");\n").arg(i).repeated(i + 1),
+            "a.js"));
+        stream += sent.back() + (i % 2 == 0 ? "\n" : "\r\n");
+        if (i % 10 == 0)
+            stream += "\n"; // empty lines are ignored
+    }
+    JsonLineFramer framer;
+    std::vector<std::string> received;
+    size_t nRunScripts = 0;
+    for (size_t pos = 0, step = 1; pos < stream.size(); pos += step, ++step)
+        framer.feed(stream.data() + pos, std::min(step, stream.size() - pos),
+                    [&received, &nRunScripts](const char *msg, size_t len) {
+                        received.emplace_back(msg, len);
+                        size_t stopPos;
+                        parseOutputFromGui(
+                            {msg, len}, stopPos,
+                            [&nRunScripts](QString, QString) { ++nRunScripts; },
+                            [](QString) { ADD_FAILURE(); });
+                        EXPECT_EQ(len, stopPos);
+                    });
+    EXPECT_EQ(0u, framer.pendingSize());
+    EXPECT_TRUE(sent == received);
+    EXPECT_EQ(sent.size(), nRunScripts);
+
+    // line is passed only once, so broken one should be reported
+    const std::string broken = sent[0].substr(0, sent[0].size() - 1);
+    size_t nErrors = 0;
+    parseLineFromGui(broken.data(), broken.size(),
+                     [](QString, QString) { ADD_FAILURE(); },
+                     [&nErrors](QString) { ++nErrors; });
+    EXPECT_EQ(1u, nErrors);
+    nErrors = 0;
+    const std::string garbage = sent[0] + "garbage";
+    parseLineFromGui(garbage.data(), garbage.size(),
+                     [&nRunScripts](QString, QString) { ++nRunScripts; },
+                     [&nErrors](QString) { ++nErrors; });
+    EXPECT_EQ(1u, nErrors);
+}
+
+TEST(QtMonkey, BinaryProtocolConformance)
+{
+    using namespace qt_monkey_app;
+    QString tricky = QString("\"quote\" \\ \t\r\n") + QChar(0x1)
+                     + QChar(0x0444) + QChar(0x2028);
+    tricky += QChar(0xD83D);
+    tricky += QChar(0xDE00); // surrogate pair
+    auto writeAll = [&tricky](Protocol protocol) {
+        std::string buf;
+        PacketWriter writer{buf, protocol};
+        auto endPacket = [&buf, protocol]() {
+            if (protocol == Protocol::Json)
+                buf += '\n';
+        };
+        for (int i = 0; i < 10; ++i) {
+            writer.userAppEvent(tricky.repeated(i + 1),
+                                i % 2 == 0 ? QString() : QString("worker"));
+            endPacket();
+            writer.userAppOutput(tricky);
+            endPacket();
+            writer.userAppErrors(QString("error %1").arg(i));
+            endPacket();
+            writer.scriptError(QString("script error %1").arg(i));
+            endPacket();
+            writer.scriptLog(tricky + QString::number(i));
+            endPacket();
+            writer.scriptEnd();
+            endPacket();
+            writer.runScript(tricky, QString("%1.js").arg(i));
+            endPacket();
+        }
+        return buf;
+    };
+    using Log = std::vector<QString>;
+    auto parseAll = [](Protocol protocol, const std::string &stream) {
+        Log log;
+        auto onEvent = [&log](QString s) { log.push_back("event:" + s); };
+        auto onError = [&log](QString s) { log.push_back("errors:" + s); };
+        auto onScriptError
+            = [&log](QString s) { log.push_back("script error:" + s); };
+        auto onEnd = [&log]() { log.push_back("end"); };
+        auto onLog = [&log](QString s) { log.push_back("log:" + s); };
+        auto onRunScript = [&log](QString script, QString file) {
+            log.push_back("run:" + script + ":" + file);
+        };
+        auto onParseError = [](QString) { ADD_FAILURE(); };
+        JsonLineFramer jsonFramer;
+        BinaryFramer binFramer;
+        for (size_t pos = 0, step = 1; pos < stream.size();
+             pos += step, ++step) {
+            const size_t len = std::min(step, stream.size() - pos);
+            if (protocol == Protocol::Json) {
+                jsonFramer.feed(stream.data() + pos, len,
+                                [&](const char *msg, size_t msgLen) {
+                                    size_t stopPos;
+                                    parseOutputFromMonkeyApp(
+                                        {msg, msgLen}, stopPos, onEvent,
+                                        onError, onScriptError, onEnd, onLog,
+                                        onParseError);
+                                    parseOutputFromGui({msg, msgLen}, stopPos,
+                                                       onRunScript,
+                                                       onParseError);
+                                });
+            } else {
+                EXPECT_TRUE(binFramer.feed(
+                    stream.data() + pos, len,
+                    [&](MessageType type, const char *payload,
+                        size_t payloadLen) {
+                        parseBinaryFrameFromMonkeyApp(
+                            type, payload, payloadLen, onEvent, onError,
+                            onScriptError, onEnd, onLog, onParseError);
+                        parseBinaryFrameFromGui(type, payload, payloadLen,
+                                                onRunScript, onParseError);
+                    }));
+            }
+        }
+        EXPECT_EQ(0u, jsonFramer.pendingSize());
+        EXPECT_EQ(0u, binFramer.pendingSize());
+        return log;
+    };
+    const Log jsonLog = parseAll(Protocol::Json, writeAll(Protocol::Json));
+    const Log binaryLog
+        = parseAll(Protocol::Binary, writeAll(Protocol::Binary));
+    EXPECT_EQ(60u, jsonLog.size());
+    EXPECT_TRUE(jsonLog == binaryLog);
+
+    BinaryFramer damaged;
+    const char badHeader[] = "\x01\0\0\0\xff\xff\xff\xff";
+    EXPECT_FALSE(damaged.feed(badHeader, sizeof(badHeader) - 1,
+                              [](MessageType, const char *, size_t) {
+                                  ADD_FAILURE();
+                              }));
+}
+
+TEST(QtMonkey, OutputBatcher)
+{
+    using qt_monkey_app::OutputBatcher;
+    OutputBatcher::Options opts;
+    opts.windowMs = 100;
+    opts.bytesPerSecond = 18;
+    OutputBatcher::Budget budget{opts.bytesPerSecond};
+    OutputBatcher batcher{opts, budget};
+    std::vector<std::string> batches;
+    auto onBatch = [&batches](const char *data, size_t len) {
+        batches.emplace_back(data, len);
+    };
+    batcher.append("line1\nli", 8, 0);
+    EXPECT_FALSE(batcher.batchReady(50));
+    batcher.append("ne2\nline", 8, 60);
+    EXPECT_TRUE(batcher.batchReady(100));
+    batcher.flush(100, false, onBatch);
+    ASSERT_EQ(1u, batches.size());
+    EXPECT_EQ("line1\nline2\n", batches[0]);
+    // budget is exhausted, so lines till the end of second are dropped
+    batcher.append("3\nline4\nline5\n", 14, 150);
+    batcher.flush(250, false, onBatch);
+    ASSERT_EQ(2u, batches.size());
+    EXPECT_EQ("line3\n<<<qtmonkey: 2 lines (12 bytes) of output dropped>>>\n",
+              batches[1]);
+    EXPECT_EQ(2u, batcher.stats().droppedLines);
+    batcher.append("line6", 5, 1200);
+    batcher.flush(1210, true, onBatch);
+    ASSERT_EQ(3u, batches.size());
+    EXPECT_EQ("line6", batches[2]);
+    EXPECT_TRUE(batcher.empty());
+
+    // line longer than budget is cut, and budget is shared between batchers
+    opts.bytesPerSecond = 10;
+    OutputBatcher::Budget sharedBudget{opts.bytesPerSecond};
+    OutputBatcher outBatcher{opts, sharedBudget};
+    OutputBatcher errBatcher{opts, sharedBudget};
+    batches.clear();
+    outBatcher.append("0123456789abcdef\nxyz\n", 21, 0);
+    errBatcher.append("err\n", 4, 10);
+    outBatcher.flush(20, true, onBatch);
+    errBatcher.flush(20, true, onBatch);
+    ASSERT_EQ(2u, batches.size());
+    EXPECT_EQ("0123456789\n<<<qtmonkey: 2 lines (11 bytes) of output "
+              "dropped>>>\n",
+              batches[0]);
+    EXPECT_EQ("<<<qtmonkey: 1 lines (4 bytes) of output dropped>>>\n",
+              batches[1]);
+}
+
+TEST(QtMonkey, SuiteHistory)
+{
+    using qt_monkey_app::SuiteHistory;
+    SuiteHistory history;
+    history.setDuration("short.js", 1.5);
+    history.setDuration("long.js", 100.);
+    history.setDuration("middle.js", 10.);
+    const QStringList order = history.longestFirst(QStringList()
+                                                   << "short.js"
+                                                   << "new.js"
+                                                   << "long.js"
+                                                   << "middle.js");
+    EXPECT_EQ(QStringList() << "new.js"
+                            << "long.js"
+                            << "middle.js"
+                            << "short.js",
+              order);
+
+    const QString path
+        = QDir::temp().filePath(QStringLiteral("qtmonkey_durations.json"));
+    QString errMsg;
+    ASSERT_TRUE(history.save(path, errMsg)) << qPrintable(errMsg);
+    SuiteHistory loaded;
+    ASSERT_TRUE(loaded.load(path, errMsg)) << qPrintable(errMsg);
+    EXPECT_EQ(order, loaded.longestFirst(order));
+    EXPECT_DOUBLE_EQ(10., loaded.duration("middle.js"));
+    EXPECT_LT(loaded.duration("new.js"), 0.);
+    QFile::remove(path);
+}
+
 TEST(Script, basic)
 {
     using qt_monkey_agent::Private::Script;
@@ -192,6 +650,117 @@ TEST(Script, basic)
     EXPECT_EQ(1, res.begin()->beginLineNum());
     res = Script::splitToExecutableParts("test1.js", QString());
     ASSERT_EQ(0u, res.size());
+
+    res = Script::splitToExecutableParts(
+        "test1.js", "<<<IN PROCESS launcher>>>\nTest1();\n<<<IN PROCESS "
+                    "worker 1>>>\nTest2();\n<<<RESTART FROM HERE>>>\nTest3();\n");
+    ASSERT_EQ(3u, res.size());
+    it = res.begin();
+    EXPECT_EQ(QString("\nTest1();\n"), it->code());
+    EXPECT_EQ(QString("launcher"), it->processName());
+    EXPECT_FALSE(it->continuesPreviousPart());
+    ++it;
+    EXPECT_EQ(QString("\nTest2();\n"), it->code());
+    EXPECT_EQ(QString("worker 1"), it->processName());
+    EXPECT_EQ(3, it->beginLineNum());
+    EXPECT_TRUE(it->continuesPreviousPart());
+    ++it;
+    EXPECT_EQ(QString("\nTest3();\n"), it->code());
+    EXPECT_TRUE(it->processName().isEmpty());
+    EXPECT_FALSE(it->continuesPreviousPart());
+}
+
+TEST(WidgetSelector, compile)
+{
+    using qt_monkey_agent::Private::WidgetSelector;
+    using Kind = WidgetSelector::Segment::Kind;
+
+    auto sel = WidgetSelector::compile(
+        "MainWindow.<class_name=QPushButton,2>.<class_name=QLabel>.<class_"
+        "name=>.<class_name=QMenu,x>");
+    ASSERT_TRUE(sel != nullptr);
+    const auto &segs = sel->segments();
+    ASSERT_EQ(5, segs.size());
+
+    EXPECT_TRUE(segs[0].kind == Kind::ObjectName);
+    EXPECT_EQ(QString("MainWindow"), segs[0].name);
+    EXPECT_TRUE(segs[0].className.isEmpty());
+
+    EXPECT_TRUE(segs[1].kind == Kind::ClassName);
+    EXPECT_EQ(QString("<class_name=QPushButton,2>"), segs[1].name);
+    EXPECT_EQ(QByteArray("QPushButton"), segs[1].className);
+    EXPECT_EQ(2, segs[1].order);
+
+    EXPECT_TRUE(segs[2].kind == Kind::ClassName);
+    EXPECT_EQ(QByteArray("QLabel"), segs[2].className);
+    EXPECT_EQ(0, segs[2].order);
+
+    EXPECT_TRUE(segs[3].kind == Kind::ObjectName);
+
+    EXPECT_TRUE(segs[4].kind == Kind::ClassName);
+    EXPECT_EQ(QByteArray("QMenu"), segs[4].className);
+    EXPECT_EQ(0, segs[4].order);
+}
+
+TEST(SpscQueue, orderAndOverflow)
+{
+    qt_monkey_common::SpscQueue<int, 8> queue;
+    const int nValues = 100000;
+    std::atomic<int> nWakeups{0};
+    std::thread producer([&queue, &nWakeups] {
+        for (int i = 0; i < nValues; ++i)
+            if (queue.push(i))
+                ++nWakeups;
+    });
+    int expected = 0;
+    while (expected < nValues)
+        queue.consumeAll([&expected](int val) {
+            EXPECT_EQ(expected, val);
+            expected = val + 1;
+        });
+    producer.join();
+    EXPECT_EQ(nValues, expected);
+    EXPECT_GE(nWakeups.load(), 1);
+    EXPECT_LE(nWakeups.load(), nValues);
+}
+
+TEST(Semaphore, roundTrip)
+{
+    using qt_monkey_common::Semaphore;
+    // the same pattern as runCodeInGuiThreadSync: request and wait response
+    Semaphore request{0}, response{0};
+    const int nRoundTrips = 20000;
+    int handled = 0;
+    std::thread peer([&request, &response, &handled] {
+        for (int i = 0; i < nRoundTrips; ++i) {
+            request.acquire();
+            ++handled;
+            response.release();
+        }
+    });
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nRoundTrips; ++i) {
+        request.release();
+        response.acquire();
+        ASSERT_EQ(i + 1, handled);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    peer.join();
+    std::cout << "Semaphore round trip: "
+              << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                         .count()
+                     / nRoundTrips
+              << " ns\n";
+
+    Semaphore sem{0};
+    EXPECT_FALSE(sem.tryAcquire(1, std::chrono::milliseconds(20)));
+    std::thread releaser([&sem] {
+        for (int i = 0; i < 3; ++i)
+            sem.release();
+    });
+    sem.acquire(3);
+    releaser.join();
+    EXPECT_FALSE(sem.tryAcquire(1, std::chrono::milliseconds(0)));
 }
 
 #if QT_VERSION >= 0x050000
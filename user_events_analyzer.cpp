@@ -1,6 +1,7 @@
 //#define DEBUG_ANALYZER
 #include "user_events_analyzer.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
@@ -19,6 +20,8 @@
 #include <QTableView>
 #include <QTreeWidget>
 #include <QWidget>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
 
 #include "agent.hpp"
 #include "common.hpp"
@@ -28,8 +31,10 @@ using qt_monkey_agent::EventInfo;
 using qt_monkey_agent::GenerateCommand;
 using qt_monkey_agent::UserEventsAnalyzer;
 using qt_monkey_agent::Private::MacMenuActionWatcher;
+using qt_monkey_agent::Private::RecordedEvent;
 using qt_monkey_agent::Private::TreeViewWatcher;
 using qt_monkey_agent::Private::TreeWidgetWatcher;
+using qt_monkey_agent::Private::WidgetIdCache;
 
 #ifdef DEBUG_ANALYZER
 #define DBGPRINT(fmt, ...) qDebug(fmt, __VA_ARGS__)
@@ -79,58 +84,59 @@ static QString qtObjectId(const QObject &w)
     return name;
 }
 
-static QString keyReleaseEventToScript(const QString &widgetName,
-                                       QKeyEvent *keyEvent)
+static QString keyEventToScript(const QString &widgetName, int key,
+                                Qt::KeyboardModifiers keyModifiers,
+                                const QString &keyText)
 {
-    if (keyEvent->key() == 0)
+    if (key == 0)
         return QStringLiteral("//some special key");
 
     DBGPRINT("%s: widgtName: %s, key %X, %s", Q_FUNC_INFO,
-             qPrintable(widgetName), keyEvent->key(),
-             keyEvent->key() != Qt::Key_unknown ? "known key" : "unknown key");
+             qPrintable(widgetName), key,
+             key != Qt::Key_unknown ? "known key" : "unknown key");
 
     int modifiers[4] = {0, 0, 0, 0};
     int curMod = 0;
 
-    if (keyEvent->modifiers() & Qt::ShiftModifier)
+    if (keyModifiers & Qt::ShiftModifier)
         modifiers[curMod++] = Qt::ShiftModifier;
 
-    if (keyEvent->modifiers() & Qt::AltModifier)
+    if (keyModifiers & Qt::AltModifier)
         modifiers[curMod++] = Qt::AltModifier;
 
-    if (keyEvent->modifiers() & Qt::ControlModifier)
+    if (keyModifiers & Qt::ControlModifier)
         modifiers[curMod++] = Qt::ControlModifier;
 
-    if (keyEvent->modifiers() & Qt::MetaModifier)
+    if (keyModifiers & Qt::MetaModifier)
         modifiers[curMod++] = Qt::MetaModifier;
 
     QKeySequence keySeq;
     switch (curMod) {
     case 1:
-        if (keyEvent->key() != Qt::Key_unknown)
-            keySeq = QKeySequence(modifiers[0], keyEvent->key());
+        if (key != Qt::Key_unknown)
+            keySeq = QKeySequence(modifiers[0], key);
         else
             keySeq = QKeySequence(modifiers[0]);
         break;
     case 2:
-        if (keyEvent->key() != Qt::Key_unknown)
-            keySeq = QKeySequence(modifiers[0], modifiers[1], keyEvent->key());
+        if (key != Qt::Key_unknown)
+            keySeq = QKeySequence(modifiers[0], modifiers[1], key);
         else
             keySeq = QKeySequence(modifiers[0], modifiers[1]);
         break;
     case 3:
-        if (keyEvent->key() != Qt::Key_unknown)
+        if (key != Qt::Key_unknown)
             keySeq = QKeySequence(modifiers[0], modifiers[1], modifiers[2],
-                                  keyEvent->key());
+                                  key);
         else
             keySeq = QKeySequence(modifiers[0], modifiers[1], modifiers[2]);
         break;
     case 4:
-        keySeq = QKeySequence(keyEvent->text());
+        keySeq = QKeySequence(keyText);
         break;
     case 0:
     default:
-        keySeq = QKeySequence(keyEvent->key());
+        keySeq = QKeySequence(key);
         break;
     }
 
@@ -139,13 +145,12 @@ static QString keyReleaseEventToScript(const QString &widgetName,
 }
 
 static QString mouseEventToJavaScript(const QString &widgetName,
-                                      QMouseEvent *mouseEvent,
+                                      bool isDblClick, Qt::MouseButton button,
                                       const QPoint &pos)
 {
-    const QString mouseBtn
-        = qt_monkey_agent::mouseButtonEnumToString(mouseEvent->button());
+    const QString mouseBtn = qt_monkey_agent::mouseButtonEnumToString(button);
 
-    if (mouseEvent->type() == QEvent::MouseButtonDblClick)
+    if (isDblClick)
         return QStringLiteral("Test.mouseDClick('%1', '%2', %3, %4);")
             .arg(widgetName, mouseBtn)
             .arg(pos.x())
@@ -199,28 +204,6 @@ static QString qmenuActivateClick(const EventInfo &eventInfo)
     return res;
 }
 
-static QWidget *searchThroghSuperClassesAndParents(QWidget *widget,
-                                                   const char *wname,
-                                                   size_t limit = size_t(-1))
-{
-    DBGPRINT("%s: begin: wname %s", Q_FUNC_INFO, wname);
-    for (size_t i = 0; widget != nullptr && i < limit; ++i) {
-        const QMetaObject *mo = widget->metaObject();
-        while (mo && std::strcmp(mo->className(), wname) != 0) {
-            mo = mo->superClass();
-        }
-
-        if (mo != nullptr) {
-            DBGPRINT("%s: yeah, it(%s) is %s", Q_FUNC_INFO,
-                     qPrintable(widget->objectName()), wname);
-            return widget;
-        } else {
-            widget = qobject_cast<QWidget *>(widget->parent());
-        }
-    }
-    return nullptr;
-}
-
 static QString qtreeWidgetActivateClick(const EventInfo &eventInfo)
 {
     static TreeWidgetWatcher treeWidgetWatcher(eventInfo.codeGenerator);
@@ -243,8 +226,7 @@ static QString qtreeWidgetActivateClick(const EventInfo &eventInfo)
     auto mouseEvent = static_cast<QMouseEvent *>(event);
     const QPoint pos = widget->mapFromGlobal(mouseEvent->globalPos());
 
-    QWidget *treeWidget
-        = searchThroghSuperClassesAndParents(widget, "QTreeWidget", 2);
+    QWidget *treeWidget = eventInfo.matchedWidget;
 
     if (treeWidget == nullptr
         || (widget != treeWidget
@@ -300,8 +282,7 @@ static QString qlistWidgetActivateClick(const EventInfo &eventInfo)
     auto mouseEvent = static_cast<QMouseEvent *>(event);
     const QPoint pos = widget->mapFromGlobal(mouseEvent->globalPos());
 
-    if (QWidget *alistwdg
-        = searchThroghSuperClassesAndParents(widget, "QListWidget")) {
+    if (QWidget *alistwdg = eventInfo.matchedWidget) {
         DBGPRINT("%s: this is QListWidget", Q_FUNC_INFO);
         QListWidget *listwdg = qobject_cast<QListWidget *>(alistwdg);
         if (listwdg == nullptr)
@@ -346,8 +327,7 @@ static QString qcomboBoxActivateClick(const EventInfo &eventInfo)
     auto mouseEvent = static_cast<QMouseEvent *>(event);
     const QPoint pos = widget->mapFromGlobal(mouseEvent->globalPos());
 
-    if (QWidget *combobox
-        = searchThroghSuperClassesAndParents(widget, "QComboBox")) {
+    if (QWidget *combobox = eventInfo.matchedWidget) {
         DBGPRINT("%s: this is combobox", Q_FUNC_INFO);
         if (widget == combobox)
             return res;
@@ -362,10 +342,6 @@ static QString qcomboBoxActivateClick(const EventInfo &eventInfo)
         return QStringLiteral("Test.activateItem('%1', '%2');")
             .arg(qt_monkey_agent::fullQtWidgetId(*combobox),
                  qobject_cast<QComboBox *>(combobox)->itemText(idx.row()));
-    } else if (searchThroghSuperClassesAndParents(widget, "QListWidget")
-               != nullptr) {
-        DBGPRINT("%s: this is QListWidget", Q_FUNC_INFO);
-        return qlistWidgetActivateClick(eventInfo);
     }
     return res;
 }
@@ -382,7 +358,7 @@ static QString qtabBarActivateClick(const EventInfo &eventInfo)
     auto mouseEvent = static_cast<QMouseEvent *>(event);
     const QPoint pos = widget->mapFromGlobal(mouseEvent->globalPos());
 
-    auto tabBar = qobject_cast<QTabBar *>(widget);
+    auto tabBar = qobject_cast<QTabBar *>(eventInfo.matchedWidget);
     if (tabBar == nullptr)
         return res;
     const int tab = tabBar->tabAt(pos);
@@ -435,8 +411,7 @@ static QString qtreeViewActivateClick(const EventInfo &eventInfo)
     auto mouseEvent = static_cast<QMouseEvent *>(event);
     const QPoint pos = widget->mapFromGlobal(mouseEvent->globalPos());
 
-    QWidget *tree_view
-        = searchThroghSuperClassesAndParents(widget, "QTreeView", 2);
+    QWidget *tree_view = eventInfo.matchedWidget;
     if (tree_view == nullptr)
         return res;
 
@@ -479,8 +454,7 @@ static QString qlistViewActivateClick(const EventInfo &eventInfo)
         return res;
     auto mouseEvent = static_cast<QMouseEvent *>(event);
     const QPoint pos = widget->mapFromGlobal(mouseEvent->globalPos());
-    QWidget *listView
-        = searchThroghSuperClassesAndParents(widget, "QListView", 2);
+    QWidget *listView = eventInfo.matchedWidget;
     if (listView == nullptr)
         return res;
 
@@ -522,8 +496,7 @@ static QString qtableViewActivateClick(const EventInfo &eventInfo)
     auto mouseEvent = static_cast<QMouseEvent *>(event);
     const QPoint pos = widget->mapFromGlobal(mouseEvent->globalPos());
 
-    QWidget *tbl_view
-        = searchThroghSuperClassesAndParents(widget, "QTableView", 2);
+    QWidget *tbl_view = eventInfo.matchedWidget;
     if (tbl_view == nullptr) {
         return res;
     }
@@ -649,8 +622,6 @@ static QString qmenuOnMacTriggered(const EventInfo &eventInfo)
     }
     return res;
 }
-#else
-static QString qmenuOnMacTriggered(const EventInfo &) { return QString(); }
 #endif
 
 static const std::pair<Qt::MouseButton, QLatin1String> mouseBtnNames[] = {
@@ -735,17 +706,50 @@ QString qt_monkey_agent::mouseButtonEnumToString(Qt::MouseButton b)
     return QLatin1String("<unknown button>");
 }
 
+QString qt_monkey_agent::Private::recordedEventToScript(const RecordedEvent &ev)
+{
+    switch (ev.type) {
+    case RecordedEvent::Type::Script:
+    case RecordedEvent::Type::Log:
+        return ev.text;
+    case RecordedEvent::Type::Key:
+        if (!ev.text.isEmpty())
+            return ev.text;
+        return keyEventToScript(ev.widgetName, ev.key, ev.modifiers,
+                                ev.keyText);
+    case RecordedEvent::Type::MouseClick:
+    case RecordedEvent::Type::MouseDblClick: {
+        const bool isDblClick = ev.type == RecordedEvent::Type::MouseDblClick;
+        QString script = ev.text;
+        if (script.isEmpty())
+            script = mouseEventToJavaScript(ev.widgetName, isDblClick,
+                                            ev.button, ev.pos);
+        if (!ev.hasAnotherVariant)
+            return script;
+        QString anotherScript = ev.anotherText;
+        if (anotherScript.isEmpty())
+            anotherScript = mouseEventToJavaScript(
+                ev.anotherWidgetName, isDblClick, ev.button, ev.anotherPos);
+        if (script != anotherScript)
+            script = QString("%1\n//another variant:%2")
+                         .arg(script, anotherScript);
+        return script;
+    }
+    }
+    return QString();
+}
+
 QString qt_monkey_agent::fullQtWidgetId(const QObject &w)
 {
-    QString res = qtObjectId(w);
+    if (WidgetIdCache *cache = WidgetIdCache::instance())
+        return cache->fullId(w);
+    QStringList ids;
+    for (const QObject *cur_obj = &w; cur_obj != nullptr;
+         cur_obj = cur_obj->parent())
+        ids.prepend(qtObjectId(*cur_obj));
     DBGPRINT("%s: class name %s, id %s", Q_FUNC_INFO,
-             w.metaObject()->className(), qPrintable(res));
-    QObject *cur_obj = w.parent();
-    while (cur_obj != nullptr) {
-        res = qtObjectId(*cur_obj) + "." + res;
-        cur_obj = cur_obj->parent();
-    }
-    return res;
+             w.metaObject()->className(), qPrintable(ids.last()));
+    return ids.join(QStringLiteral("."));
 }
 
 UserEventsAnalyzer::UserEventsAnalyzer(
@@ -753,17 +757,113 @@ UserEventsAnalyzer::UserEventsAnalyzer(
     std::list<CustomEventAnalyzer> customEventAnalyzers, QObject *parent)
     : QObject(parent), agent_(agent),
       customEventAnalyzers_(std::move(customEventAnalyzers)),
-      generateScriptCmd_(
-          [this](QString code) { emit userEventInScriptForm(code); }),
-      showObjectShortCut_(showObjectShortCut)
+      generateScriptCmd_([this](QString code) {
+          record(RecordedEvent::script(std::move(code)));
+      }),
+      showObjectShortCut_(showObjectShortCut),
+      widgetIdCache_(new WidgetIdCache(this))
 {
-    for (auto &&fun :
-         {qmenuActivateClick, qtreeWidgetActivateClick, qcomboBoxActivateClick,
-          qlistWidgetActivateClick, qtabBarActivateClick,
-          qtreeViewActivateClick, qlistViewActivateClick,
-          qtableViewActivateClick, workspaceTitleBarPressed,
-          clickOnUnnamedButton, qmenuOnMacTriggered})
-        customEventAnalyzers_.emplace_back(fun);
+    QCoreApplication::instance()->installEventFilter(widgetIdCache_);
+    const std::vector<QEvent::Type> clickEvents
+        = {QEvent::MouseButtonPress, QEvent::MouseButtonDblClick};
+    const std::vector<QEvent::Type> clickAndReleaseEvents
+        = {QEvent::MouseButtonPress, QEvent::MouseButtonDblClick,
+           QEvent::MouseButtonRelease};
+    const std::vector<QEvent::Type> pressEvents = {QEvent::MouseButtonPress};
+    customEventAnalyzers_.emplace_back(qmenuActivateClick, clickEvents, "QMenu",
+                                       1);
+    customEventAnalyzers_.emplace_back(qtreeWidgetActivateClick,
+                                       clickAndReleaseEvents, "QTreeWidget", 2);
+    customEventAnalyzers_.emplace_back(qcomboBoxActivateClick, clickEvents,
+                                       "QComboBox");
+    customEventAnalyzers_.emplace_back(qlistWidgetActivateClick, clickEvents,
+                                       "QListWidget");
+    customEventAnalyzers_.emplace_back(qtabBarActivateClick, clickEvents,
+                                       "QTabBar", 1);
+    customEventAnalyzers_.emplace_back(qtreeViewActivateClick,
+                                       clickAndReleaseEvents, "QTreeView", 2);
+    customEventAnalyzers_.emplace_back(qlistViewActivateClick, clickEvents,
+                                       "QListView", 2);
+    customEventAnalyzers_.emplace_back(qtableViewActivateClick, clickEvents,
+                                       "QTableView", 2);
+    customEventAnalyzers_.emplace_back(workspaceTitleBarPressed, pressEvents);
+    customEventAnalyzers_.emplace_back(clickOnUnnamedButton, pressEvents);
+#ifdef Q_OS_MAC
+    customEventAnalyzers_.emplace_back(
+        qmenuOnMacTriggered,
+        std::vector<QEvent::Type>{QEvent::ActionAdded, QEvent::ActionChanged,
+                                  QEvent::ActionRemoved});
+#endif
+    buildDispatchTable();
+}
+
+void UserEventsAnalyzer::buildDispatchTable()
+{
+    // event filter called for every event in application, so
+    // precalculate list of analyzers for each event type,
+    // order of analyzers should be preserved
+    size_t maxType = 0;
+    for (const CustomEventAnalyzer &analyzer : customEventAnalyzers_)
+        for (QEvent::Type type : analyzer.eventTypes())
+            maxType = std::max(maxType, static_cast<size_t>(type));
+
+    analyzersByType_.assign(maxType + 1, AnalyzersList());
+    wildcards_.clear();
+    filterClasses_.clear();
+    classMatchCache_.clear();
+    for (const CustomEventAnalyzer &analyzer : customEventAnalyzers_) {
+        Route route{&analyzer, -1};
+        if (!analyzer.className().isEmpty()) {
+            auto it = std::find(filterClasses_.begin(), filterClasses_.end(),
+                                analyzer.className());
+            route.classIdx = static_cast<int>(it - filterClasses_.begin());
+            if (it == filterClasses_.end())
+                filterClasses_.push_back(analyzer.className());
+        }
+        if (analyzer.eventTypes().empty()) {
+            wildcards_.push_back(route);
+            for (AnalyzersList &lst : analyzersByType_)
+                lst.push_back(route);
+            continue;
+        }
+        for (QEvent::Type type : analyzer.eventTypes()) {
+            AnalyzersList &lst = analyzersByType_[static_cast<size_t>(type)];
+            if (lst.empty() || lst.back().analyzer != &analyzer)
+                lst.push_back(route);
+        }
+    }
+}
+
+const std::vector<bool> &
+UserEventsAnalyzer::filterClassesOf(const QMetaObject &mo) const
+{
+    auto it = classMatchCache_.find(&mo);
+    if (it != classMatchCache_.end())
+        return it->second;
+    DBGPRINT("%s: new class %s", Q_FUNC_INFO, mo.className());
+    std::vector<bool> matches(filterClasses_.size(), false);
+    for (const QMetaObject *cur = &mo; cur != nullptr;
+         cur = cur->superClass()) {
+        for (size_t i = 0; i < filterClasses_.size(); ++i)
+            if (!matches[i]
+                && std::strcmp(cur->className(), filterClasses_[i].constData())
+                       == 0)
+                matches[i] = true;
+    }
+    return classMatchCache_.emplace(&mo, std::move(matches)).first->second;
+}
+
+QWidget *UserEventsAnalyzer::matchClassFilter(QWidget *widget,
+                                              const Route &route) const
+{
+    const size_t maxDepth = route.analyzer->maxDepth();
+    const size_t classIdx = static_cast<size_t>(route.classIdx);
+    for (size_t i = 0; widget != nullptr && i < maxDepth; ++i) {
+        if (filterClassesOf(*widget->metaObject())[classIdx])
+            return widget;
+        widget = qobject_cast<QWidget *>(widget->parent());
+    }
+    return nullptr;
 }
 
 QString
@@ -772,15 +872,27 @@ UserEventsAnalyzer::callCustomEventAnalyzers(QObject *obj, QEvent *event,
                                              const QString &widgetName) const
 {
     QString code;
-    for (auto &&userCustomAnalyzer : customEventAnalyzers_) {
-        code = userCustomAnalyzer(
-            {agent_, obj, event, widget, widgetName, generateScriptCmd_});
+    for (const Route &route : analyzersFor(event->type())) {
+        QWidget *matchedWidget = nullptr;
+        if (route.classIdx != -1) {
+            matchedWidget = matchClassFilter(widget, route);
+            if (matchedWidget == nullptr)
+                continue;
+        }
+        code = (*route.analyzer)({agent_, obj, event, widget, widgetName,
+                                  generateScriptCmd_, matchedWidget});
         if (!code.isEmpty())
             return code;
     }
     return code;
 }
 
+void UserEventsAnalyzer::record(RecordedEvent event)
+{
+    if (recordedEvents_.push(std::move(event)))
+        emit newRecordedEvents();
+}
+
 bool UserEventsAnalyzer::alreadySawSuchKeyEvent(QKeyEvent *keyEvent)
 {
     const QDateTime now = QDateTime::currentDateTime();
@@ -866,7 +978,10 @@ bool UserEventsAnalyzer::eventFilter(QObject *obj, QEvent *event)
                                   | static_cast<int>(keyEvent->modifiers())};
         if (keyEvent->type() == QEvent::KeyPress
             && curKey == showObjectShortCut_) {
-            emit scriptLog(widgetUnderCursorInfo());
+            RecordedEvent logEvent;
+            logEvent.type = RecordedEvent::Type::Log;
+            logEvent.text = widgetUnderCursorInfo();
+            record(std::move(logEvent));
             break;
         }
         QWidget *w = QApplication::focusWidget();
@@ -878,13 +993,20 @@ bool UserEventsAnalyzer::eventFilter(QObject *obj, QEvent *event)
                 break;
             }
         }
-        const QString widgetName = qt_monkey_agent::fullQtWidgetId(*w);
-        QString scriptLine
-            = callCustomEventAnalyzers(obj, event, w, widgetName);
-        if (scriptLine.isEmpty())
-            scriptLine = keyReleaseEventToScript(widgetName, keyEvent);
-        DBGPRINT("%s: we emit '%s'", Q_FUNC_INFO, qPrintable(scriptLine));
-        emit userEventInScriptForm(scriptLine);
+        RecordedEvent keyRecord;
+        keyRecord.type = RecordedEvent::Type::Key;
+        keyRecord.widgetName = qt_monkey_agent::fullQtWidgetId(*w);
+        keyRecord.text
+            = callCustomEventAnalyzers(obj, event, w, keyRecord.widgetName);
+        keyRecord.key = keyEvent->key();
+        keyRecord.modifiers = keyEvent->modifiers();
+        // text is used only if all modifiers are pressed
+        const Qt::KeyboardModifiers allModifiers
+            = Qt::ShiftModifier | Qt::AltModifier | Qt::ControlModifier
+              | Qt::MetaModifier;
+        if ((keyRecord.modifiers & allModifiers) == allModifiers)
+            keyRecord.keyText = keyEvent->text();
+        record(std::move(keyRecord));
         break;
     }
     case QEvent::MouseButtonRelease:
@@ -909,36 +1031,34 @@ bool UserEventsAnalyzer::eventFilter(QObject *obj, QEvent *event)
             return false;
         }
 
-        QString widgetName = fullQtWidgetId(*w);
-        if (alreadySawSuchMouseEvent(widgetName, mouseEvent))
+        RecordedEvent click;
+        click.type = event->type() == QEvent::MouseButtonDblClick
+                         ? RecordedEvent::Type::MouseDblClick
+                         : RecordedEvent::Type::MouseClick;
+        click.widgetName = fullQtWidgetId(*w);
+        if (alreadySawSuchMouseEvent(click.widgetName, mouseEvent))
             break;
-        QString scriptLine
-            = callCustomEventAnalyzers(obj, event, w, widgetName);
-        QPoint pos = w->mapFromGlobal(clickPos);
-        if (scriptLine.isEmpty())
-            scriptLine = mouseEventToJavaScript(widgetName, mouseEvent, pos);
+        click.text = callCustomEventAnalyzers(obj, event, w, click.widgetName);
+        click.pos = w->mapFromGlobal(clickPos);
+        click.button = mouseEvent->button();
 
         if (w->objectName().isEmpty() && !isOnlyOneChildWithSuchClass(*w)) {
             QWidget *baseWidget = w;
             while (w != nullptr && w->objectName().isEmpty())
                 w = qobject_cast<QWidget *>(w->parent());
             if (w != nullptr && w != baseWidget) {
-                pos = w->mapFromGlobal(clickPos);
-                widgetName = fullQtWidgetId(*w);
-                if (alreadySawSuchMouseEvent(widgetName, mouseEvent))
+                click.hasAnotherVariant = true;
+                click.anotherPos = w->mapFromGlobal(clickPos);
+                click.anotherWidgetName = fullQtWidgetId(*w);
+                if (alreadySawSuchMouseEvent(click.anotherWidgetName,
+                                             mouseEvent))
                     return QObject::eventFilter(obj, event);
-                QString anotherScript
-                    = callCustomEventAnalyzers(obj, event, w, widgetName);
-                if (anotherScript.isEmpty())
-                    anotherScript
-                        = mouseEventToJavaScript(widgetName, mouseEvent, pos);
-                if (scriptLine != anotherScript)
-                    scriptLine = QString("%1\n//another variant:%2")
-                                     .arg(scriptLine, anotherScript);
+                click.anotherText = callCustomEventAnalyzers(
+                    obj, event, w, click.anotherWidgetName);
             }
         }
-        DBGPRINT("%s: emit userEventInScriptForm", Q_FUNC_INFO);
-        emit userEventInScriptForm(scriptLine);
+        DBGPRINT("%s: record click", Q_FUNC_INFO);
+        record(std::move(click));
         break;
     } // event by mouse
     case QEvent::Shortcut: {
@@ -949,16 +1069,144 @@ bool UserEventsAnalyzer::eventFilter(QObject *obj, QEvent *event)
     }
     // fall through
     default: {
-        const QString code
-            = callCustomEventAnalyzers(obj, event, nullptr, QString());
+        if (analyzersFor(event->type()).empty())
+            break;
+        QString code = callCustomEventAnalyzers(obj, event, nullptr, QString());
         if (!code.isEmpty())
-            emit userEventInScriptForm(code);
+            record(RecordedEvent::script(std::move(code)));
         break;
     }
     } // switch (event->type())
     return QObject::eventFilter(obj, event);
 }
 
+WidgetIdCache *WidgetIdCache::gInstance_ = nullptr;
+
+WidgetIdCache::WidgetIdCache(QObject *parent) : QObject(parent)
+{
+    assert(gInstance_ == nullptr);
+    gInstance_ = this;
+}
+
+WidgetIdCache::~WidgetIdCache()
+{
+    assert(gInstance_ == this);
+    gInstance_ = nullptr;
+}
+
+WidgetIdCache *WidgetIdCache::instance()
+{
+    if (gInstance_ == nullptr
+        || QThread::currentThread() != gInstance_->thread())
+        return nullptr;
+    return gInstance_;
+}
+
+QString WidgetIdCache::fullId(const QObject &obj)
+{
+    auto it = entries_.find(&obj);
+#if QT_VERSION < 0x050000
+    if (it != entries_.end() && !checkNames(obj))
+        it = entries_.find(&obj);
+#endif
+    if (it != entries_.end())
+        return it->second.fullId;
+
+    QString id = qtObjectId(obj);
+    const QObject *parent = obj.parent();
+    if (parent != nullptr) {
+        id = fullId(*parent) + QLatin1Char('.') + id;
+        entries_[parent].children.push_back(&obj);
+    }
+    DBGPRINT("%s: cache id %s", Q_FUNC_INFO, qPrintable(id));
+    Entry &entry = entries_[&obj];
+    entry.fullId = id;
+#if QT_VERSION < 0x050000
+    entry.name = obj.objectName();
+#else
+    connect(&obj, SIGNAL(objectNameChanged(const QString &)), this,
+            SLOT(onObjectNameChanged()), Qt::UniqueConnection);
+#endif
+    entry.parent = parent;
+    connect(&obj, SIGNAL(destroyed(QObject *)), this,
+            SLOT(onObjectDestroyed(QObject *)), Qt::UniqueConnection);
+    return id;
+}
+
+#if QT_VERSION < 0x050000
+bool WidgetIdCache::checkNames(const QObject &obj)
+{
+    const QObject *renamed = nullptr;
+    for (const QObject *cur = &obj; cur != nullptr; cur = cur->parent()) {
+        auto it = entries_.find(cur);
+        if (it == entries_.end() || it->second.name != cur->objectName())
+            renamed = cur;
+    }
+    if (renamed == nullptr)
+        return true;
+    invalidate(renamed);
+    return false;
+}
+#endif
+
+void WidgetIdCache::invalidate(const QObject *obj)
+{
+    auto it = entries_.find(obj);
+    if (it == entries_.end())
+        return;
+    std::vector<const QObject *> children;
+    children.swap(it->second.children);
+    const QObject *parent = it->second.parent;
+    entries_.erase(it);
+    if (parent != nullptr) {
+        auto pit = entries_.find(parent);
+        if (pit != entries_.end()) {
+            auto &siblings = pit->second.children;
+            siblings.erase(std::remove(siblings.begin(), siblings.end(), obj),
+                           siblings.end());
+        }
+    }
+    for (const QObject *child : children)
+        invalidate(child);
+}
+
+void WidgetIdCache::invalidateChildren(const QObject *obj)
+{
+    auto it = entries_.find(obj);
+    if (it == entries_.end())
+        return;
+    std::vector<const QObject *> children;
+    children.swap(it->second.children);
+    for (const QObject *child : children)
+        invalidate(child);
+}
+
+bool WidgetIdCache::eventFilter(QObject *obj, QEvent *event)
+{
+    switch (event->type()) {
+    case QEvent::ChildAdded:
+    case QEvent::ChildRemoved:
+        // order among siblings with the same class may be changed
+        if (!entries_.empty())
+            invalidateChildren(obj);
+        break;
+    case QEvent::ParentChange:
+        if (!entries_.empty())
+            invalidate(obj);
+        break;
+    default:
+        break;
+    }
+    return QObject::eventFilter(obj, event);
+}
+
+void WidgetIdCache::onObjectNameChanged()
+{
+    invalidate(sender());
+}
+
+void WidgetIdCache::onObjectDestroyed(QObject *obj) { invalidate(obj); }
+
 void TreeWidgetWatcher::itemExpanded(QTreeWidgetItem *twi)
 {
     DBGPRINT("%s begin", Q_FUNC_INFO);
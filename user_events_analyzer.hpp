@@ -3,6 +3,8 @@
 #include <list>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <vector>
 
 #include <QKeySequence>
 #include <QPoint>
@@ -11,6 +13,7 @@
 #include <QtCore/QObject>
 
 #include "custom_event_analyzer.hpp"
+#include "spsc_queue.hpp"
 
 class QTreeWidget;
 class QTreeWidgetItem;
@@ -20,10 +23,55 @@ class QTreeView;
 class QModelIndex;
 class QAbstractItemModel;
 class QAction;
+struct QMetaObject;
 
 namespace qt_monkey_agent
 {
 class Agent;
+namespace Private
+{
+class WidgetIdCache;
+
+/**
+ * Compact description of user's event, captured in GUI thread,
+ * and converted to script in agent thread
+ */
+struct RecordedEvent final {
+    enum class Type : quint8 {
+        Script,        //!< text contains ready code
+        Log,           //!< text contains message for log
+        Key,           //!< key press or release
+        MouseClick,    //!< mouse button press
+        MouseDblClick, //!< mouse double click
+    };
+    Type type = Type::Script;
+    //! code from custom analyzer, if not empty used instead of generated one
+    QString text;
+    QString widgetName;
+    QPoint pos;
+    int key = 0;
+    Qt::KeyboardModifiers modifiers = Qt::NoModifier;
+    QString keyText;
+    Qt::MouseButton button = Qt::NoButton;
+    //@{
+    //! another variant of click: click on the nearest parent with name
+    bool hasAnotherVariant = false;
+    QString anotherText;
+    QString anotherWidgetName;
+    QPoint anotherPos;
+    //@}
+
+    static RecordedEvent script(QString code)
+    {
+        RecordedEvent ev;
+        ev.text = std::move(code);
+        return ev;
+    }
+};
+
+//! can be used in any thread
+QString recordedEventToScript(const RecordedEvent &event);
+} // namespace Private
 
 //@{
 //! helper functions to implement custom event analyzers
@@ -48,13 +96,21 @@ class UserEventsAnalyzer
 {
     Q_OBJECT
 signals:
-    void userEventInScriptForm(const QString &);
-    void scriptLog(const QString &);
+    //! emitted only when queue of recorded events becomes not empty
+    void newRecordedEvents();
 
 public:
     UserEventsAnalyzer(Agent &agent, const QKeySequence &showObjectShortCut,
                        std::list<CustomEventAnalyzer> customEventAnalyzers,
                        QObject *parent = nullptr);
+    /**
+     * Take all recorded events, should be called only from one thread
+     * @param func called with Private::RecordedEvent
+     */
+    template <typename Func> void consumeRecordedEvents(Func &&func)
+    {
+        recordedEvents_.consumeAll(std::forward<Func>(func));
+    }
 
 private:
     Agent &agent_;
@@ -73,13 +129,40 @@ private:
     size_t keyPress_ = 0;
     size_t keyRelease_ = 0;
     std::list<CustomEventAnalyzer> customEventAnalyzers_;
+    struct Route final {
+        const CustomEventAnalyzer *analyzer;
+        //! index in filterClasses_ or -1 if there is no class filter
+        int classIdx;
+    };
+    using AnalyzersList = std::vector<Route>;
+    //! analyzers for event type, if type is out of range use wildcards_
+    std::vector<AnalyzersList> analyzersByType_;
+    //! analyzers that interested in all events
+    AnalyzersList wildcards_;
+    //! names of classes from class filters of analyzers
+    std::vector<QByteArray> filterClasses_;
+    //! for each class: what of filterClasses_ it inherits
+    mutable std::unordered_map<const QMetaObject *, std::vector<bool>>
+        classMatchCache_;
     const GenerateCommand generateScriptCmd_;
     const QKeySequence showObjectShortCut_;
+    Private::WidgetIdCache *widgetIdCache_ = nullptr;
+    qt_monkey_common::SpscQueue<Private::RecordedEvent, 256> recordedEvents_;
 
     bool eventFilter(QObject *obj, QEvent *event) override;
+    void record(Private::RecordedEvent event);
+    void buildDispatchTable();
+    const AnalyzersList &analyzersFor(QEvent::Type type) const
+    {
+        const size_t idx = static_cast<size_t>(type);
+        return idx < analyzersByType_.size() ? analyzersByType_[idx]
+                                             : wildcards_;
+    }
     QString callCustomEventAnalyzers(QObject *obj, QEvent *event,
                                      QWidget *widget,
                                      const QString &widgetName) const;
+    const std::vector<bool> &filterClassesOf(const QMetaObject &mo) const;
+    QWidget *matchClassFilter(QWidget *widget, const Route &route) const;
     bool alreadySawSuchKeyEvent(QKeyEvent *keyEvent);
     bool alreadySawSuchMouseEvent(const QString &widgetName,
                                   QMouseEvent *mouseEvent);
@@ -87,6 +170,50 @@ private:
 
 namespace Private
 {
+/**
+ * Cache of results of fullQtWidgetId, should be installed
+ * as application wide event filter to track changes of objects hierarchy.
+ * Used only in GUI thread.
+ */
+class WidgetIdCache
+#ifndef Q_MOC_RUN
+    final
+#endif
+    : public QObject
+{
+    Q_OBJECT
+public:
+    explicit WidgetIdCache(QObject *parent = nullptr);
+    ~WidgetIdCache();
+    //! @return nullptr if there is no cache for current thread
+    static WidgetIdCache *instance();
+    QString fullId(const QObject &obj);
+private slots:
+    void onObjectNameChanged();
+    void onObjectDestroyed(QObject *obj);
+
+private:
+    struct Entry final {
+        QString fullId;
+#if QT_VERSION < 0x050000
+        //! there is no signal about rename in Qt 4.x, so check it lazily
+        QString name;
+#endif
+        const QObject *parent;
+        std::vector<const QObject *> children;
+    };
+    std::unordered_map<const QObject *, Entry> entries_;
+    static WidgetIdCache *gInstance_;
+
+    bool eventFilter(QObject *obj, QEvent *event) override;
+    //! forget about object and all its children
+    void invalidate(const QObject *obj);
+    void invalidateChildren(const QObject *obj);
+#if QT_VERSION < 0x050000
+    bool checkNames(const QObject &obj);
+#endif
+};
+
 //@{
 //! helper classes to catch signals of widgets
 //! \todo remove when we drop support of Qt 4.x
@@ -0,0 +1,356 @@
+//#define DEBUG_WIDGET_INDEX
+#include "widget_index.hpp"
+
+#include <cassert>
+#include <limits>
+#include <utility>
+
+#include <QApplication>
+#include <QWidget>
+#include <QtCore/QEvent>
+#include <QtCore/QThread>
+#include <QtCore/QTimerEvent>
+
+using qt_monkey_agent::Private::WidgetIndex;
+
+#ifdef DEBUG_WIDGET_INDEX
+#define DBGPRINT(fmt, ...) qDebug(fmt, __VA_ARGS__)
+#else
+#define DBGPRINT(fmt, ...)                                                     \
+    do {                                                                       \
+    } while (false)
+#endif
+
+namespace
+{
+// there is no event about rename of object (and no signal in Qt 4),
+// so waiters should be checked periodically anyway
+static const int waitersCheckIntervalMs = 500;
+
+static int depthInHierarchy(const QObject &obj)
+{
+    int depth = 0;
+    for (QObject *p = obj.parent(); p != nullptr; p = p->parent())
+        ++depth;
+    return depth;
+}
+
+static bool isSuitable(const QWidget &w, bool shouldBeEnabled)
+{
+    return !shouldBeEnabled || (w.isEnabled() && w.isVisible());
+}
+
+template <typename Bucket>
+static void appendIfNotExists(Bucket &bucket, QWidget *w)
+{
+    for (const auto &ptr : bucket)
+        if (ptr.data() == w)
+            return;
+    bucket.append(w);
+}
+} // namespace
+
+WidgetIndex::WidgetIndex(QObject *parent)
+    : QObject(parent), checkWaitersEventType_(static_cast<QEvent::Type>(
+                           QEvent::registerEventType()))
+{
+}
+
+bool WidgetIndex::eventFilter(QObject *obj, QEvent *event)
+{
+    if (!waiters_.empty() && obj->isWidgetType()) {
+        switch (event->type()) {
+        case QEvent::Show:
+        case QEvent::Hide:
+        case QEvent::EnabledChange:
+        case QEvent::ChildAdded:
+        case QEvent::ChildPolished:
+        case QEvent::ParentChange:
+        case QEvent::WindowActivate:
+            scheduleWaitersCheck();
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (!seeded_)
+        return QObject::eventFilter(obj, event);
+
+    switch (event->type()) {
+    case QEvent::ChildAdded: {
+        // at this point child not constructed yet, so it is impossible
+        // to get real class name, and usually object name is not set yet,
+        // so postpone adding to index till next search
+        QObject *child = static_cast<QChildEvent *>(event)->child();
+        if (child != nullptr && child->isWidgetType())
+            pending_.append(child);
+        break;
+    }
+    case QEvent::PolishRequest:
+    case QEvent::Polish:
+        // top level widgets have no parent, so we see them only here,
+        // PolishRequest is posted by constructor of every widget, so
+        // we see also hidden ones
+        if (obj->isWidgetType() && obj->parent() == nullptr)
+            pending_.append(obj);
+        break;
+    default:
+        break;
+    }
+    return QObject::eventFilter(obj, event);
+}
+
+void WidgetIndex::sync()
+{
+    assert(QThread::currentThread() == qApp->thread());
+    if (!seeded_) {
+        seeded_ = true;
+        const QWidgetList allWdg = QApplication::allWidgets();
+        entries_.reserve(allWdg.size());
+        for (QWidget *w : allWdg)
+            add(*w);
+        DBGPRINT("%s: seeded with %d widgets", Q_FUNC_INFO, allWdg.size());
+        return;
+    }
+    if (pending_.isEmpty())
+        return;
+    QVector<QPointer<QObject>> pending;
+    pending.swap(pending_);
+    for (const QPointer<QObject> &obj : pending) {
+        if (obj.isNull())
+            continue;
+        if (QWidget *w = qobject_cast<QWidget *>(obj.data()))
+            add(*w);
+    }
+}
+
+void WidgetIndex::rescan()
+{
+    DBGPRINT("%s: begin", Q_FUNC_INFO);
+    pending_.clear();
+    const QWidgetList allWdg = QApplication::allWidgets();
+    for (QWidget *w : allWdg)
+        add(*w);
+    // forget about destroyed widgets, buckets will be cleaned by prune
+    if (entries_.size() > 2 * allWdg.size()) {
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (it->widget.isNull())
+                it = entries_.erase(it);
+            else
+                ++it;
+        }
+    }
+}
+
+void WidgetIndex::add(QWidget &w)
+{
+    auto it = entries_.find(&w);
+    if (it != entries_.end() && !it->widget.isNull()) {
+        // already in index, check that it was not renamed
+        const QString name = w.objectName();
+        if (it->name == name)
+            return;
+        DBGPRINT("%s: %s renamed to %s", Q_FUNC_INFO, qPrintable(it->name),
+                 qPrintable(name));
+        // old bucket will be cleaned by prune
+        it->name = name;
+        if (!name.isEmpty())
+            appendIfNotExists(byName_[name], &w);
+        return;
+    }
+#if QT_VERSION >= 0x050000
+    // without this rename to name of other widget is not visible to search,
+    // because of rescan happens only for unknown names
+    QWidget *renamed = &w;
+    connect(renamed, &QObject::objectNameChanged, this, [this, renamed] {
+        add(*renamed);
+        // widget may become findable by new name
+        if (!waiters_.empty())
+            scheduleWaitersCheck();
+    });
+#endif
+    Entry entry;
+    entry.widget = &w;
+    entry.name = w.objectName();
+    if (!entry.name.isEmpty())
+        byName_[entry.name].append(entry.widget);
+    byClass_[QByteArray(w.metaObject()->className())].append(entry.widget);
+    if (it != entries_.end()) {
+        // object with the same address was destroyed
+        *it = std::move(entry);
+    } else {
+        entries_.insert(&w, std::move(entry));
+    }
+}
+
+bool WidgetIndex::prune(const QString &name, Bucket &bucket)
+{
+    bool changed = false;
+    for (int i = 0; i < bucket.size();) {
+        QWidget *w = bucket[i].data();
+        if (w == nullptr || (!name.isEmpty() && w->objectName() != name)) {
+            bucket.remove(i);
+            changed = true;
+        } else {
+            ++i;
+        }
+    }
+    return changed;
+}
+
+QWidget *WidgetIndex::searchByName(const QString &name, bool topmost,
+                                   bool shouldBeEnabled, bool &known)
+{
+    auto it = byName_.find(name);
+    if (it == byName_.end())
+        return nullptr;
+    if (prune(name, *it) && it->isEmpty()) {
+        byName_.erase(it);
+        return nullptr;
+    }
+    known = true;
+    QWidget *res = nullptr;
+    int minDepth = std::numeric_limits<int>::max();
+    for (const QPointer<QWidget> &ptr : *it) {
+        QWidget *w = ptr.data();
+        assert(w != nullptr);
+        if (!isSuitable(*w, shouldBeEnabled))
+            continue;
+        if (!topmost)
+            return w;
+        const int depth = depthInHierarchy(*w);
+        if (depth < minDepth) {
+            minDepth = depth;
+            res = w;
+        }
+    }
+    return res;
+}
+
+QWidget *WidgetIndex::searchByClass(const QByteArray &className,
+                                    bool shouldBeEnabled, bool &known)
+{
+    auto it = byClass_.find(className);
+    if (it == byClass_.end())
+        return nullptr;
+    prune(QString(), *it);
+    known = !it->isEmpty();
+    for (const QPointer<QWidget> &ptr : *it)
+        if (isSuitable(*ptr, shouldBeEnabled))
+            return ptr.data();
+    return nullptr;
+}
+
+QWidget *WidgetIndex::topmostWithName(const QString &name, bool &mayRescan)
+{
+    sync();
+    bool known = false;
+    QWidget *w = searchByName(name, true, false, known);
+#if QT_VERSION < 0x050000
+    if (!known && mayRescan) {
+        // may be it was renamed after we add it to index
+        mayRescan = false;
+        rescan();
+        w = searchByName(name, true, false, known);
+    }
+#else
+    // index is kept up to date by events and objectNameChanged,
+    // so unknown name usually means that widget not created yet
+    (void)mayRescan;
+#endif
+    DBGPRINT("%s: %s -> %p", Q_FUNC_INFO, qPrintable(name), w);
+    return w;
+}
+
+QWidget *WidgetIndex::anyWithNameOrClass(const QString &name,
+                                         const QByteArray &className,
+                                         bool shouldBeEnabled,
+                                         bool &mayRescan)
+{
+    sync();
+    bool known = false;
+    auto search = [this, &name, &className, shouldBeEnabled, &known] {
+        return className.isEmpty()
+                   ? searchByName(name, false, shouldBeEnabled, known)
+                   : searchByClass(className, shouldBeEnabled, known);
+    };
+    QWidget *w = search();
+#if QT_VERSION < 0x050000
+    if (!known && mayRescan) {
+        mayRescan = false;
+        rescan();
+        w = search();
+    }
+#else
+    (void)mayRescan;
+#endif
+    DBGPRINT("%s: %s/%s -> %p", Q_FUNC_INFO, qPrintable(name),
+             className.constData(), w);
+    return w;
+}
+
+quint64 WidgetIndex::addWaiter(Waiter waiter)
+{
+    assert(QThread::currentThread() == qApp->thread());
+    const quint64 id = nextWaiterId_++;
+    waiters_.emplace(id, std::move(waiter));
+    if (!waitersTimer_.isActive())
+        waitersTimer_.start(waitersCheckIntervalMs, this);
+    return id;
+}
+
+void WidgetIndex::removeWaiter(quint64 id)
+{
+    assert(QThread::currentThread() == qApp->thread());
+    waiters_.erase(id);
+    if (waiters_.empty())
+        waitersTimer_.stop();
+}
+
+void WidgetIndex::scheduleWaitersCheck()
+{
+    if (checkWaitersPosted_)
+        return;
+    checkWaitersPosted_ = true;
+    // check after event processing, when widget state is actually changed
+    QCoreApplication::postEvent(this, new QEvent(checkWaitersEventType_));
+}
+
+void WidgetIndex::checkWaiters()
+{
+    DBGPRINT("%s: %u waiters", Q_FUNC_INFO,
+             static_cast<unsigned>(waiters_.size()));
+    for (auto it = waiters_.begin(); it != waiters_.end();) {
+        if (it->second())
+            it = waiters_.erase(it);
+        else
+            ++it;
+    }
+    if (waiters_.empty())
+        waitersTimer_.stop();
+}
+
+bool WidgetIndex::event(QEvent *event)
+{
+    if (event->type() == checkWaitersEventType_) {
+        checkWaitersPosted_ = false;
+        checkWaiters();
+        return true;
+    }
+    return QObject::event(event);
+}
+
+void WidgetIndex::timerEvent(QTimerEvent *event)
+{
+    if (event->timerId() == waitersTimer_.timerId()) {
+#if QT_VERSION < 0x050000
+        // waiters never rescan, so catch renames here, not more often
+        // than once per interval
+        rescan();
+#endif
+        checkWaiters();
+        return;
+    }
+    QObject::timerEvent(event);
+}
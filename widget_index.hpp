@@ -0,0 +1,121 @@
+#pragma once
+
+#include <functional>
+#include <map>
+
+#include <QtCore/QBasicTimer>
+#include <QtCore/QByteArray>
+#include <QtCore/QEvent>
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QPointer>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+class QWidget;
+
+namespace qt_monkey_agent
+{
+namespace Private
+{
+/**
+ * Index of application's widgets by object name and by class name,
+ * so search of widget by id do not require walk through all widgets.
+ * Should be installed as application wide event filter to track
+ * creation of widgets, and should be used only from GUI thread.
+ * Index is lazy: it do nothing until first search.
+ */
+class WidgetIndex final : public QObject
+{
+public:
+    /**
+     * Check condition of wait, called in GUI thread
+     * @return true if wait is finished and waiter should be removed
+     */
+    using Waiter = std::function<bool()>;
+
+    explicit WidgetIndex(QObject *parent = nullptr);
+    WidgetIndex(const WidgetIndex &) = delete;
+    WidgetIndex &operator=(const WidgetIndex &) = delete;
+
+    //@{
+    /**
+     * Search widget with such object name, if there are several such widgets
+     * return the one that nearest to top of widgets hierarchy
+     * @param mayRescan if true and there are no such widgets in index,
+     * walk through all widgets; set to false after walk, so several
+     * searches for one widget's id walk at most once. Waiters should
+     * pass false: they are called after every change of widgets.
+     * Used only with Qt 4, there is no signal about rename in it
+     * @return nullptr if nothing found
+     */
+    QWidget *topmostWithName(const QString &name, bool &mayRescan);
+    /**
+     * Search widget with such class name (if className not empty) or
+     * with such object name
+     * @param shouldBeEnabled if true return only visible and enabled widget
+     * @param mayRescan the same as for topmostWithName
+     * @return nullptr if nothing found
+     */
+    QWidget *anyWithNameOrClass(const QString &name,
+                                const QByteArray &className,
+                                bool shouldBeEnabled, bool &mayRescan);
+    //@}
+    /**
+     * Register waiter, it will be called after changes of widgets
+     * that can affect result of search, and periodically to catch changes
+     * without events (like rename of object)
+     * @return id that can be used to remove waiter
+     */
+    quint64 addWaiter(Waiter waiter);
+    //! it is safe to remove already finished waiter
+    void removeWaiter(quint64 id);
+
+private:
+    struct Entry final {
+        QPointer<QWidget> widget;
+        QString name;
+    };
+    using Bucket = QVector<QPointer<QWidget>>;
+
+    QHash<QObject *, Entry> entries_;
+    QHash<QString, Bucket> byName_;
+    QHash<QByteArray, Bucket> byClass_;
+    QVector<QPointer<QObject>> pending_;
+    bool seeded_ = false;
+    std::map<quint64, Waiter> waiters_;
+    quint64 nextWaiterId_ = 0;
+    QEvent::Type checkWaitersEventType_;
+    bool checkWaitersPosted_ = false;
+    QBasicTimer waitersTimer_;
+
+    bool eventFilter(QObject *obj, QEvent *event) override;
+    bool event(QEvent *event) override;
+    void timerEvent(QTimerEvent *event) override;
+    //! coalesce several changes of widgets into one check of waiters
+    void scheduleWaitersCheck();
+    void checkWaiters();
+    //! make sure that all known widgets are in index
+    void sync();
+    //! walk through all widgets and add missed or renamed ones
+    void rescan();
+    void add(QWidget &w);
+    /**
+     * remove destroyed and renamed widgets from bucket
+     * @return true if something was changed in index
+     */
+    bool prune(const QString &name, Bucket &bucket);
+    //@{
+    /**
+     * search in index without update of it
+     * @param known set to true if there are such widgets in index,
+     * but they may be not suitable
+     */
+    QWidget *searchByName(const QString &name, bool topmost,
+                          bool shouldBeEnabled, bool &known);
+    QWidget *searchByClass(const QByteArray &className, bool shouldBeEnabled,
+                           bool &known);
+    //@}
+};
+} // namespace Private
+} // namespace qt_monkey_agent
@@ -0,0 +1,47 @@
+#include "widget_selector.hpp"
+
+#include <QtCore/QStringList>
+
+using qt_monkey_agent::Private::WidgetSelector;
+
+WidgetSelector::Segment WidgetSelector::parseSegment(const QString &text)
+{
+    static const QLatin1String classPrefix("<class_name=");
+    static const int classPrefixLen = 12;
+
+    Segment seg;
+    seg.name = text;
+    // equivalent of ^<class_name=([^>]+)>$
+    if (text.size() <= classPrefixLen + 1 || !text.startsWith(classPrefix)
+        || !text.endsWith(QLatin1Char('>')))
+        return seg;
+    const QString body
+        = text.mid(classPrefixLen, text.size() - classPrefixLen - 1);
+    if (body.contains(QLatin1Char('>')))
+        return seg;
+
+    seg.kind = Segment::Kind::ClassName;
+    const QStringList res
+        = body.split(QLatin1Char(','), QString::SkipEmptyParts);
+    if (!res.isEmpty())
+        seg.className = res[0].toLatin1();
+    if (res.size() > 1) {
+        bool ok = false;
+        seg.order = res[1].toInt(&ok);
+        if (!ok)
+            seg.order = 0;
+    }
+    return seg;
+}
+
+std::shared_ptr<const WidgetSelector>
+WidgetSelector::compile(const QString &id)
+{
+    std::shared_ptr<WidgetSelector> res{new WidgetSelector};
+    res->id_ = id;
+    const QStringList names = id.split(QLatin1Char('.'));
+    res->segments_.reserve(names.size());
+    for (const QString &name : names)
+        res->segments_.append(parseSegment(name));
+    return res;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+namespace qt_monkey_agent
+{
+namespace Private
+{
+/**
+ * Compiled form of widget id like "MainWindow.<class_name=QPushButton,1>",
+ * so search of widget do not require parsing of id on each attempt
+ */
+class WidgetSelector final
+{
+public:
+    struct Segment final {
+        enum class Kind { ObjectName, ClassName };
+        Kind kind = Kind::ObjectName;
+        //! text of segment as is, compared with object name
+        QString name;
+        //! not empty only for Kind::ClassName
+        QByteArray className;
+        //! order among siblings with the same class
+        int order = 0;
+    };
+
+    static std::shared_ptr<const WidgetSelector> compile(const QString &id);
+
+    const QString &id() const { return id_; }
+    const QVector<Segment> &segments() const { return segments_; }
+
+private:
+    QString id_;
+    QVector<Segment> segments_;
+
+    WidgetSelector() = default;
+    static Segment parseSegment(const QString &text);
+};
+} // namespace Private
+} // namespace qt_monkey_agent